@@ -1,34 +1,74 @@
-#include <tbb/task_scheduler_init.h>
+// lets a task_scheduler_observer watch a single arena in TBB before oneTBB, where that's still a preview
+#define TBB_PREVIEW_LOCAL_OBSERVER 1
+#include <tbb/task_arena.h>
 #include <tbb/task_group.h>
-
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_scheduler_observer.h>
 
 #include <lua.hpp>
 #include <lauxlib.h>
 #include <lualib.h>
 
 #include <map>
+#include <deque>
 #include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <tuple>
 #include <string>
 #include <cassert>
 #include <cstdlib>
 #include <array>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <cstring>
+#include <climits>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
-//#define SHOW_INSTRS
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 //#define SINGLETHREADED
 
-//#define USE_APPLY_TASK
+//#define ITTPROFILE
+
+//#define PROBE_STATS
 
-//#define USE_TSX
+// the tbb::task API, which --apply=task is built on, is gone from oneTBB
+#if TBB_INTERFACE_VERSION < 12000
+#define HAVE_APPLY_TASK
+#endif
 
-#define BENCHMARK
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
 
-//#define ITTPROFILE
+#ifdef PROBE_STATS
+#include <tbb/enumerable_thread_specific.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #ifdef ITTPROFILE
 #include <C:\Program Files (x86)\IntelSWTools\VTune Amplifier 2016 for Systems\include\ittnotify.h>
@@ -40,1134 +80,5383 @@ __itt_domain* robdd_itt_domain = __itt_domain_create(L"robdd");
 __itt_string_handle* robdd_itt_decode_task = __itt_string_handle_create(L"decode");
 #endif
 
+// an unsigned integer of any size, for solution counts that don't fit in 64 bits
+class big_uint
+{
+    // least significant first, without leading zero words
+    std::vector<uint64_t> words;
+
+    void trim()
+    {
+        while (!words.empty() && words.back() == 0)
+        {
+            words.pop_back();
+        }
+    }
+
+public:
+    big_uint() { }
+
+    explicit big_uint(uint64_t value)
+    {
+        if (value != 0)
+        {
+            words.push_back(value);
+        }
+    }
+
+    static big_uint power_of_two(uint32_t exponent)
+    {
+        big_uint b;
+        b.words.assign(exponent / 64 + 1, 0);
+        b.words.back() = uint64_t(1) << (exponent % 64);
+        return b;
+    }
+
+    big_uint& operator+=(const big_uint& other)
+    {
+        if (words.size() < other.words.size())
+        {
+            words.resize(other.words.size(), 0);
+        }
+
+        uint64_t carry = 0;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint64_t o = i < other.words.size() ? other.words[i] : 0;
+            uint64_t sum = words[i] + o;
+            uint64_t carry_out = sum < o;
+            words[i] = sum + carry;
+            carry_out |= words[i] < sum;
+            carry = carry_out;
+            if (!carry && i >= other.words.size())
+            {
+                break;
+            }
+        }
+        if (carry)
+        {
+            words.push_back(1);
+        }
+        return *this;
+    }
+
+    // other must not be larger
+    big_uint& operator-=(const big_uint& other)
+    {
+        uint64_t borrow = 0;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint64_t o = i < other.words.size() ? other.words[i] : 0;
+            uint64_t diff = words[i] - o;
+            uint64_t borrow_out = words[i] < o;
+            borrow_out |= diff < borrow;
+            words[i] = diff - borrow;
+            borrow = borrow_out;
+            if (!borrow && i >= other.words.size())
+            {
+                break;
+            }
+        }
+        trim();
+        return *this;
+    }
+
+    uint32_t bit_length() const
+    {
+        if (words.empty())
+        {
+            return 0;
+        }
+
+        uint32_t bits = (uint32_t)words.size() * 64;
+        for (uint64_t top = words.back(); !(top >> 63); top <<= 1)
+        {
+            bits--;
+        }
+        return bits;
+    }
+
+    // the value divided by 2^shift, to double precision
+    double to_double(uint32_t shift = 0) const
+    {
+        double d = 0.0;
+        // the top two words hold every bit a double can keep
+        for (size_t i = words.size() >= 2 ? words.size() - 2 : 0; i < words.size(); i++)
+        {
+            d += std::ldexp((double)words[i], int(64 * i) - int(shift));
+        }
+        return d;
+    }
+
+    big_uint operator<<(uint32_t shift) const
+    {
+        big_uint b;
+        if (words.empty())
+        {
+            return b;
+        }
+
+        uint32_t word_shift = shift / 64;
+        uint32_t bit_shift = shift % 64;
+        b.words.assign(words.size() + word_shift + 1, 0);
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            b.words[i + word_shift] |= words[i] << bit_shift;
+            if (bit_shift)
+            {
+                b.words[i + word_shift + 1] = words[i] >> (64 - bit_shift);
+            }
+        }
+        b.trim();
+        return b;
+    }
+
+    std::string to_string() const
+    {
+        // peels off 9 decimal digits at a time, dividing 32 bits at a time so that nothing overflows
+        std::vector<uint32_t> digits;
+        std::vector<uint32_t> limbs;
+        for (uint64_t w : words)
+        {
+            limbs.push_back(uint32_t(w));
+            limbs.push_back(uint32_t(w >> 32));
+        }
+        while (!limbs.empty() && limbs.back() == 0)
+        {
+            limbs.pop_back();
+        }
+
+        while (!limbs.empty())
+        {
+            uint64_t rem = 0;
+            for (size_t i = limbs.size(); i-- > 0;)
+            {
+                uint64_t cur = (rem << 32) | limbs[i];
+                limbs[i] = uint32_t(cur / 1000000000);
+                rem = cur % 1000000000;
+            }
+            digits.push_back(uint32_t(rem));
+            while (!limbs.empty() && limbs.back() == 0)
+            {
+                limbs.pop_back();
+            }
+        }
+
+        if (digits.empty())
+        {
+            return "0";
+        }
+
+        std::string str = std::to_string(digits.back());
+        for (size_t i = digits.size() - 1; i-- > 0;)
+        {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%09u", digits[i]);
+            str += buf;
+        }
+        return str;
+    }
+};
+
 class robdd
 {
 public:
+    // the low bit of a handle marks a complemented edge, the rest is the node's index in the pool
     using node_handle = uint32_t;
     static const node_handle invalid_handle = -1;
 
+    static node_handle complement(node_handle h)
+    {
+        return h ^ 1;
+    }
+
+    static bool is_complemented(node_handle h)
+    {
+        return (h & 1) != 0;
+    }
+
+    static node_handle regular(node_handle h)
+    {
+        return h & ~node_handle(1);
+    }
+
+    static uint32_t node_index(node_handle h)
+    {
+        return h >> 1;
+    }
+
     struct opcode
     {
         enum {
             bdd_and,
             bdd_or,
             bdd_xor,
+            // cached with the quantified cube, care set or assignment as the second operand
+            bdd_exists,
+            bdd_cofactor,
+            bdd_constrain,
+            bdd_restrict,
+            // cached with the id of the substitution as the second operand, which isn't a node
+            bdd_compose,
+            // cached in the ternary table, keyed by three operands
+            bdd_ite,
+            bdd_and_exists,
         };
     };
 
 private:
+    // nodes are stored in canonical form, with a regular hi edge. a complemented handle stands for
+    // the negation of its node, so the cofactors it returns are complemented as well.
     class unique_table
     {
         struct node
         {
-            uint32_t var;
+            // atomic because reordering moves nodes between levels while other blocks read them
+            std::atomic<uint32_t> level;
             node_handle lo;
             node_handle hi;
-            uint64_t weight;
+            // only counted while reordering
+            std::atomic<uint32_t> refs;
         };
 
-        static const uint32_t capacity = 0x8000000;
-        static_assert((capacity & (capacity - 1)) == 0, "capacity must be power of two");
+        // the pool is a list of segments that double in size, so it can grow while other threads
+        // hold pointers into it. segment 0 holds handles [0, 2^first_segment_bits), and
+        // segment s > 0 holds handles [2^(first_segment_bits+s-1), 2^(first_segment_bits+s)).
+        static const uint32_t first_segment_bits = 16;
+        static const uint32_t max_nodes = 0x7FFFFFFF;
+        static const uint32_t num_segments = 31 - first_segment_bits + 1;
 
-        static const uint32_t bddutmask = capacity - 1;
+        std::atomic<node*> segments[num_segments];
 
-        std::unique_ptr<node[]> data_pool;
+        std::atomic<uint32_t> pool_head;
 
-        uint32_t pool_head;
+        // slots reclaimed by the last collection, handed out before bumping pool_head
+        std::unique_ptr<node_handle[]> free_list;
+        uint32_t num_free;
+        std::atomic<uint32_t> free_head;
 
-        node* pool_alloc()
+        static uint32_t highest_bit(uint32_t x)
         {
-#ifdef SINGLETHREADED
-            uint32_t old_head = pool_head++;
+#ifdef _MSC_VER
+            unsigned long i;
+            _BitScanReverse(&i, x);
+            return i;
 #else
-            uint32_t old_head = InterlockedExchangeAdd((LONG*)&pool_head, 1);
+            return 31 - __builtin_clz(x);
 #endif
-            
-            if (old_head >= capacity)
+        }
+
+        static uint32_t segment_of(node_handle h)
+        {
+            return h < (1u << first_segment_bits) ? 0 : highest_bit(h) - first_segment_bits + 1;
+        }
+
+        static uint32_t segment_base(uint32_t s)
+        {
+            return s == 0 ? 0 : 1u << (first_segment_bits + s - 1);
+        }
+
+        static uint32_t segment_size(uint32_t s)
+        {
+            return s == 0 ? 1u << first_segment_bits : 1u << (first_segment_bits + s - 1);
+        }
+
+        node_handle pool_alloc()
+        {
+            if (free_head.load(std::memory_order_relaxed) < num_free)
+            {
+                uint32_t free_idx = free_head.fetch_add(1, std::memory_order_relaxed);
+                if (free_idx < num_free)
+                {
+                    return free_list[free_idx];
+                }
+            }
+
+            // relaxed is enough: the slot is private to this thread until its handle
+            // is published into the table with release semantics
+            uint32_t old_head = pool_head.fetch_add(1, std::memory_order_relaxed);
+
+            if (old_head >= max_nodes)
             {
                 printf("pool_alloc failed\n");
                 std::abort();
             }
 
-            return &data_pool[old_head];
+            uint32_t s = segment_of(old_head);
+            if (!segments[s].load(std::memory_order_acquire))
+            {
+                if (old_head == segment_base(s))
+                {
+                    // whoever gets the first slot of a segment allocates it, and everyone else waits for them
+                    segments[s].store(new node[segment_size(s)], std::memory_order_release);
+                }
+                else
+                {
+                    while (!segments[s].load(std::memory_order_acquire))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+            return old_head;
         }
 
-        std::unique_ptr<node_handle[]> table;
+        // open addressing table of regular node handles, in buckets of one cache line. each entry packs
+        // a fingerprint of the node's hash above its handle, so a lookup only reads the nodes whose
+        // fingerprint matches. an entry's fingerprint half alone says what it is: 0 is an empty entry,
+        // all ones is one of the markers migration leaves behind, and anything else is a node.
+        static const uint32_t bucket_entries = 8;
 
-        node* false_node;
-        node* true_node;
+        static const uint64_t entry_empty = 0;
+        // an empty entry sealed by migration, and an entry whose node was copied to the next table
+        static const uint64_t entry_sealed = 0xFFFFFFFF00000001ull;
+        static const uint64_t entry_moved = 0xFFFFFFFFFFFFFFFFull;
 
-        node_handle to_handle(const node* n) const
-        {
-            return node_handle(n - &data_pool[0]);
-        }
-        
-        const node* to_node(node_handle h) const
+        static const uint32_t fingerprint_marker = 0xFFFFFFFF;
+
+        struct bucket
         {
-            return (const node*)&data_pool[h];
-        }
+            std::atomic<uint64_t> entries[bucket_entries];
+        };
 
-    public:
-        void init(uint32_t num_vars)
+        static const uint32_t initial_table_size = 0x10000;
+
+        struct hash_table
         {
-            data_pool.reset(new node[capacity]);
-            pool_head = 0;
+            bucket* buckets;
+            void* memory;
+            // mask of bucket indices
+            uint32_t mask;
+            // start growing once this many nodes are allocated
+            uint32_t grow_at;
+
+            // size is in entries
+            explicit hash_table(uint32_t size)
+            {
+                // calloc hands back lazily zeroed pages, so even a huge table is ready immediately
+                static_assert(sizeof(bucket) == 64, "buckets must be one cache line");
+                uint32_t num_buckets = size / bucket_entries;
+                memory = std::calloc(num_buckets * sizeof(bucket) + 63, 1);
+                if (!memory)
+                {
+                    printf("hash_table allocation failed\n");
+                    std::abort();
+                }
+                buckets = (bucket*)(((uintptr_t)memory + 63) & ~uintptr_t(63));
+                mask = num_buckets - 1;
+                grow_at = size - size / 4;
+            }
 
-            table.reset(new node_handle[capacity]);
-            for (uint32_t i = 0; i < capacity; i++)
+            ~hash_table()
             {
-                table[i] = invalid_handle;
+                std::free(memory);
             }
+        };
 
-            false_node = pool_alloc();
-            false_node->var = num_vars;
-            false_node->lo = false_node->hi = to_handle(false_node);
-            false_node->weight = 0;
+        static const uint32_t migrate_chunk_buckets = 0x200;
 
-            true_node = pool_alloc();
-            true_node->var = num_vars;
-            true_node->lo = true_node->hi = to_handle(true_node);
-            true_node->weight = 1;
-        }
+        // an in-progress move of every node in from into the twice as big to.
+        // inserting threads each migrate a chunk of buckets before doing their own insert.
+        struct resize_state
+        {
+            hash_table* from;
+            hash_table* to;
+            uint32_t num_chunks;
+            std::atomic<uint32_t> next_chunk;
+            std::atomic<uint32_t> chunks_done;
+
+            resize_state(hash_table* from, hash_table* to)
+                : from(from)
+                , to(to)
+                , num_chunks((from->mask + 1) / migrate_chunk_buckets)
+                , next_chunk(0)
+                , chunks_done(0)
+            { }
+        };
 
-        node_handle get_false() const
+        std::atomic<hash_table*> table;
+        std::atomic<resize_state*> resizing;
+
+        // every table and resize still reachable by some thread. only cleaned up by sweep, when nothing is inserting.
+        std::mutex resize_mutex;
+        std::vector<std::unique_ptr<hash_table>> tables;
+        std::vector<std::unique_ptr<resize_state>> resizes;
+
+#ifdef PROBE_STATS
+        struct probe_stats
         {
-            return to_handle(false_node);
-        }
+            uint64_t lookups = 0;
+            uint64_t buckets = 0;
+            uint64_t compares = 0;
+        };
 
-        node_handle get_true() const
+        tbb::enumerable_thread_specific<probe_stats> stats;
+#endif
+
+        const node* to_node(node_handle h) const
         {
-            return to_handle(true_node);
+            uint32_t i = node_index(h);
+            uint32_t s = segment_of(i);
+            return segments[s].load(std::memory_order_relaxed) + (i - segment_base(s));
         }
 
-        uint32_t get_var(node_handle h) const
+        node* to_node(node_handle h)
         {
-            return to_node(h)->var;
+            uint32_t i = node_index(h);
+            uint32_t s = segment_of(i);
+            return segments[s].load(std::memory_order_relaxed) + (i - segment_base(s));
         }
 
-        node_handle get_lo(node_handle h) const
+        // the low half of the hash picks the bucket, and the high half is mixed with the murmur3 finalizer
+        // for the fingerprint. the bucket comes straight from the sum of the key: nodes built one after the
+        // other have nearby handles, so they land in nearby cache lines, and the clusters that a plain sum
+        // makes are absorbed by the buckets. spreading the buckets with the mixed bits measured slower.
+        static uint64_t hash(uint32_t level, node_handle lo, node_handle hi)
         {
-            return to_node(h)->lo;
+            uint64_t h = ((uint64_t(lo) << 32) | hi) ^ (uint64_t(level) * 0x9E3779B97F4A7C15ull);
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ull;
+            h ^= h >> 33;
+            return (h & 0xFFFFFFFF00000000ull) | ((level + lo + hi) >> 2);
         }
 
-        node_handle get_hi(node_handle h) const
+        // 31 mixed bits, shifted away from the reserved values
+        static uint32_t fingerprint(uint64_t h)
         {
-            return to_node(h)->hi;
+            return uint32_t(h >> 33) + 1;
         }
 
-        uint64_t get_weight(node_handle h) const
+        static uint64_t make_entry(uint32_t fp, node_handle h)
         {
-            return to_node(h)->weight;
+            return (uint64_t(fp) << 32) | h;
         }
 
-        node_handle insert(uint32_t var, node_handle lo, node_handle hi)
+        static uint32_t entry_fingerprint(uint64_t e)
         {
-            uint32_t p = bddutmask & (var + lo + hi);
-
-            for (;;)
-            {
-                {
-                    uint32_t tab = table[p];
-                    if (tab != invalid_handle)
-                    {
-                        const node* curr = to_node(tab);
-                        if (curr->var == var && curr->lo == lo && curr->hi == hi)
-                        {
-                            // note: potentially leaks a node
-                            return to_handle(curr);
-                        }
-                        p = (p + 1) & bddutmask;
-                        continue;
-                    }
-                }
+            return uint32_t(e >> 32);
+        }
 
-                node* new_node = pool_alloc();
-                new_node->var = var;
-                new_node->lo = lo;
-                new_node->hi = hi;
-                // combine weights
-                {
-                    const node* lonode = to_node(lo);
-                    const node* hinode = to_node(hi);
-                    uint64_t loweight = lonode->weight << (lonode->var - var - 1);
-                    uint64_t hiweight = hinode->weight << (hinode->var - var - 1);
-                    new_node->weight = loweight + hiweight;
-                }
+        static node_handle entry_handle(uint64_t e)
+        {
+            return uint32_t(e);
+        }
 
-                node_handle handle = to_handle(new_node);
-#ifdef SINGLETHREADED
-                table[p] = handle;
-                return handle;
+        static uint32_t lowest_bit(uint32_t x)
+        {
+#ifdef _MSC_VER
+            unsigned long i;
+            _BitScanForward(&i, x);
+            return i;
 #else
-                node_handle previous_handle = InterlockedCompareExchange(&table[p], handle, invalid_handle);
-
-                if (previous_handle == invalid_handle)
-                {
-                    return handle;
-                }
+            return __builtin_ctz(x);
 #endif
-            }
         }
-    };
-
-    class computed_table
-    {
-        static const uint32_t capacity = 0x100000;
-        static_assert((capacity & (capacity - 1)) == 0, "capacity must be power of two");
 
-        static const uint32_t bddctmask = capacity - 1;
-
-        struct ctnode
+        // sets bit k of empty, marked and matching if entry k of the bucket is empty, a migration marker,
+        // or holds fingerprint fp. the entries are read without synchronization, so any hit has to be
+        // confirmed with an atomic load. a torn read only ever shows one of the entry's two halves, and the
+        // fingerprint half is enough to classify an entry, which keeps the confirmation step sufficient.
+        static void scan_bucket(const bucket& b, uint32_t fp, uint32_t& empty, uint32_t& marked, uint32_t& matching)
         {
-            uint32_t op;
-            node_handle bdd1;
-            node_handle bdd2;
-            node_handle result;
-
-            ctnode() = default;
-
-            ctnode(uint32_t op, node_handle bdd1, node_handle bdd2, node_handle result)
+#ifdef USE_SSE2
+            const __m128i* entries = (const __m128i*)b.entries;
+            __m128i fps = _mm_set1_epi32((int)fp);
+            __m128i zeros = _mm_setzero_si128();
+            __m128i markers = _mm_set1_epi32(-1);
+
+            empty = marked = matching = 0;
+            for (uint32_t i = 0; i < bucket_entries / 4; i++)
             {
-                this->op = op;
-                this->bdd1 = bdd1;
-                this->bdd2 = bdd2;
-                this->result = result;
+                // gather the fingerprint halves of four entries
+                __m128 lo_pair = _mm_castsi128_ps(_mm_load_si128(entries + 2 * i));
+                __m128 hi_pair = _mm_castsi128_ps(_mm_load_si128(entries + 2 * i + 1));
+                __m128i fingerprints = _mm_castps_si128(_mm_shuffle_ps(lo_pair, hi_pair, _MM_SHUFFLE(3, 1, 3, 1)));
+
+                empty |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(fingerprints, zeros))) << (4 * i);
+                marked |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(fingerprints, markers))) << (4 * i);
+                matching |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(fingerprints, fps))) << (4 * i);
             }
-        };
-
-        std::unique_ptr<ctnode[]> table;
-        std::unique_ptr<uint32_t[]> locks;
+#else
+            empty = marked = matching = 0;
+            for (uint32_t k = 0; k < bucket_entries; k++)
+            {
+                uint32_t entry_fp = entry_fingerprint(b.entries[k].load(std::memory_order_relaxed));
+                empty |= uint32_t(entry_fp == 0) << k;
+                marked |= uint32_t(entry_fp == fingerprint_marker) << k;
+                matching |= uint32_t(entry_fp == fp) << k;
+            }
+#endif
+        }
 
-        static constexpr uint32_t hash(node_handle bdd1, node_handle bdd2, uint32_t op)
+        bool node_matches(node_handle h, uint32_t level, node_handle lo, node_handle hi) const
         {
-            return bddctmask & (bdd1 + bdd2 + op);
+            const node* n = to_node(h);
+            return n->level.load(std::memory_order_relaxed) == level && n->lo == lo && n->hi == hi;
         }
 
-        void acquire_read(uint32_t i)
+        // copies an existing node into a table that does not have it yet. safe to repeat.
+        void migrate_node(hash_table* to, node_handle h)
         {
-#ifndef SINGLETHREADED
+            const node* n = to_node(h);
+            uint64_t hh = hash(n->level.load(std::memory_order_relaxed), n->lo, n->hi);
+            uint32_t fp = fingerprint(hh);
+            uint32_t b = uint32_t(hh) & to->mask;
+
             for (;;)
             {
-                if (InterlockedIncrement((LONG*)&locks[i]) <= 255)
+                for (uint32_t k = 0; k < bucket_entries; k++)
                 {
-                    break;
+                    std::atomic<uint64_t>& entry = to->buckets[b].entries[k];
+                    uint64_t e = entry.load(std::memory_order_acquire);
+                    if (e == entry_empty)
+                    {
+                        if (entry.compare_exchange_strong(e, make_entry(fp, h), std::memory_order_release, std::memory_order_acquire))
+                        {
+                            return;
+                        }
+                    }
+                    if (entry_fingerprint(e) == fingerprint_marker)
+                    {
+                        // to is already being migrated itself, which means h made it in before that started
+                        return;
+                    }
+                    if (entry_handle(e) == h)
+                    {
+                        return;
+                    }
                 }
+                b = (b + 1) & to->mask;
             }
-#endif
         }
 
-        void release_read(uint32_t i)
+        // moves entry k of bucket b of a table being resized into its successor, or seals it if it is empty.
+        // returns true if the entry was empty, which ends any probe sequence through it.
+        bool migrate_entry(resize_state* rs, uint32_t b, uint32_t k)
         {
-#ifndef SINGLETHREADED
-            InterlockedDecrement((LONG*)&locks[i]);
-#endif
-        }
+            std::atomic<uint64_t>& entry = rs->from->buckets[b].entries[k];
+            uint64_t e = entry.load(std::memory_order_acquire);
 
-        void acquire_write(uint32_t i)
-        {
-#ifndef SINGLETHREADED
             for (;;)
             {
-                if (InterlockedCompareExchange(&locks[i], 255, 0) == 0)
+                if (e == entry_sealed)
                 {
-                    break;
+                    return true;
+                }
+                if (e == entry_moved)
+                {
+                    return false;
+                }
+                if (e == entry_empty)
+                {
+                    if (entry.compare_exchange_strong(e, entry_sealed, std::memory_order_acquire))
+                    {
+                        return true;
+                    }
+                    continue;
                 }
+
+                migrate_node(rs->to, entry_handle(e));
+                entry.store(entry_moved, std::memory_order_release);
+                return false;
             }
-#endif
         }
 
-        void release_write(uint32_t i)
+        void help_migrate(resize_state* rs)
         {
-#ifndef SINGLETHREADED
-            InterlockedExchange(&locks[i], 0);
-#endif
-        }
+            uint32_t c = rs->next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (c >= rs->num_chunks)
+            {
+                return;
+            }
 
-    public:
-        computed_table()
-        {
-            table.reset(new ctnode[capacity]);
-            for (uint32_t i = 0; i < capacity; i++)
+            for (uint32_t b = c * migrate_chunk_buckets; b < (c + 1) * migrate_chunk_buckets; b++)
             {
-                table[i].bdd1 = invalid_handle;
+                for (uint32_t k = 0; k < bucket_entries; k++)
+                {
+                    migrate_entry(rs, b, k);
+                }
             }
 
-#ifndef SINGLETHREADED
-            locks.reset(new uint32_t[capacity]);
-            for (uint32_t i = 0; i < capacity; i++)
+            if (rs->chunks_done.fetch_add(1, std::memory_order_acq_rel) + 1 == rs->num_chunks)
             {
-                locks[i] = 0;
+                table.store(rs->to, std::memory_order_release);
+                resizing.store(nullptr, std::memory_order_release);
             }
-#endif
         }
 
-        node_handle find(node_handle bdd1, node_handle bdd2, uint32_t op)
+        void start_resize(hash_table* t)
         {
-            uint32_t h = hash(bdd1, bdd2, op);
-
-            ctnode found;
-
-#if !defined(SINGLETHREADED) && defined(USE_TSX)
-            if (_xbegin() == _XBEGIN_STARTED)
-            {
-                found = table[h];
-                _xend();
-            }
-            else
-#endif
+            if (resizing.load(std::memory_order_relaxed) || table.load(std::memory_order_relaxed) != t)
             {
-                acquire_read(h);
-                {
-                    found = table[h];
-                }
-                release_read(h);
+                return;
             }
 
-            node_handle result;
+            std::lock_guard<std::mutex> lock(resize_mutex);
 
-            if (found.bdd1 == bdd1 && found.bdd2 == bdd2 && found.op == op)
-            {
-                result = found.result;
-            }
-            else
+            if (resizing.load(std::memory_order_relaxed) || table.load(std::memory_order_relaxed) != t)
             {
-                result = invalid_handle;
+                return;
             }
 
-            return result;
+            hash_table* to = new hash_table(2 * (t->mask + 1) * bucket_entries);
+            tables.emplace_back(to);
+
+            resize_state* rs = new resize_state(t, to);
+            resizes.emplace_back(rs);
+
+            resizing.store(rs, std::memory_order_release);
         }
 
-        void insert(node_handle bdd1, node_handle bdd2, uint32_t op, node_handle r)
+        // finds or inserts the node in t. new_handle is allocated on first use and reused across retries.
+        // returns invalid_handle if t turned out to be migrating, in which case the caller starts over.
+        node_handle insert_into(hash_table* t, uint32_t level, node_handle lo, node_handle hi, node_handle& new_handle)
         {
-            uint32_t h = hash(bdd1, bdd2, op);
-            
-            ctnode newnode = ctnode(op, bdd1, bdd2, r);
+            uint64_t h = hash(level, lo, hi);
+            uint32_t fp = fingerprint(h);
+            uint32_t b = uint32_t(h) & t->mask;
 
-#if !defined(SINGLETHREADED) && defined(USE_TSX)
-            if (_xbegin() == _XBEGIN_STARTED)
-            {
-                table[h] = newnode;
-                _xend();
-            }
-            else
+#ifdef PROBE_STATS
+            probe_stats& ps = stats.local();
 #endif
+
+            for (;;)
             {
-                acquire_write(h);
+                bucket& bk = t->buckets[b];
+
+                uint32_t empty, marked, matching;
+                scan_bucket(bk, fp, empty, marked, matching);
+
+#ifdef PROBE_STATS
+                ps.buckets++;
+#endif
+
+                if (marked)
                 {
-                    table[h] = newnode;
+                    return invalid_handle;
                 }
-                release_write(h);
-            }
-        }
-    };
-
-    unique_table uniquetb;
-
-    node_handle false_node;
-    node_handle true_node;
 
-    computed_table computedtb;
+                // buckets fill up front to back, so nothing past the first empty entry can match
+                uint32_t first_empty = empty ? lowest_bit(empty) : bucket_entries;
+                matching &= (1u << first_empty) - 1;
 
-    uint32_t max_level;
-
-public:
-    robdd(uint32_t num_vars, uint32_t num_threads = -1)
-    {
-        uniquetb.init(num_vars);
+                while (matching)
+                {
+                    uint32_t k = lowest_bit(matching);
+                    matching &= matching - 1;
 
-        false_node = uniquetb.get_false();
-        true_node = uniquetb.get_true();
+                    // acquire pairs with the release CAS below, so the node's fields are visible
+                    uint64_t e = bk.entries[k].load(std::memory_order_acquire);
+                    if (entry_fingerprint(e) == fingerprint_marker)
+                    {
+                        return invalid_handle;
+                    }
 
-        max_level = ((num_threads == -1 ? tbb::task_scheduler_init::default_num_threads() : num_threads) - 1) * 2;
-#ifdef SINGLETHREADED
-        max_level = 0;
+#ifdef PROBE_STATS
+                    ps.compares++;
 #endif
-    }
 
-    node_handle get_false() const
-    {
-        return false_node;
-    }
+                    if (entry_fingerprint(e) == fp && node_matches(entry_handle(e), level, lo, hi))
+                    {
+                        // note: potentially leaks new_handle until the next collection
+                        return entry_handle(e);
+                    }
+                }
 
-    node_handle get_true() const
-    {
-        return true_node;
-    }
+                if (first_empty == bucket_entries)
+                {
+                    b = (b + 1) & t->mask;
+                    continue;
+                }
 
-    uint32_t get_var(node_handle h) const
-    {
-        return uniquetb.get_var(h);
-    }
+                if (new_handle == invalid_handle)
+                {
+                    new_handle = pool_alloc() << 1;
 
-    node_handle get_lo(node_handle h) const
-    {
-        return uniquetb.get_lo(h);
-    }
+                    node* new_node = to_node(new_handle);
+                    new_node->level.store(level, std::memory_order_relaxed);
+                    new_node->lo = lo;
+                    new_node->hi = hi;
+                }
 
-    node_handle get_hi(node_handle h) const
-    {
-        return uniquetb.get_hi(h);
-    }
+#ifdef SINGLETHREADED
+                bk.entries[first_empty].store(make_entry(fp, new_handle), std::memory_order_relaxed);
+#else
+                // release publishes the node's fields. on failure someone else took the entry, maybe for
+                // this very node, so the bucket is scanned again.
+                uint64_t expected = entry_empty;
+                if (!bk.entries[first_empty].compare_exchange_strong(expected, make_entry(fp, new_handle), std::memory_order_release, std::memory_order_relaxed))
+                {
+                    continue;
+                }
+#endif
 
-    uint64_t get_weight(node_handle h) const
-    {
-        return uniquetb.get_weight(h);
-    }
+                if (num_allocated() >= t->grow_at)
+                {
+                    start_resize(t);
+                }
 
-    node_handle make_node(uint32_t var, node_handle lo, node_handle hi)
-    {
-        // enforce no-redundance constraint of ROBDD
-        if (lo == hi) return lo;
-        // enforce uniqueness constraint of ROBDD
-        // hash table returns the node if it exists
-        // and inserts the node if it doesn't
-        return uniquetb.insert(var, lo, hi);
-    }
+                return new_handle;
+            }
+        }
 
-#ifdef USE_APPLY_TASK
-    class make_node_task : public tbb::task
-    {
-        robdd* m_bdd;
-        node_handle m_bdd1;
-        node_handle m_bdd2;
-        uint32_t m_op;
-        node_handle* m_n;
+        // insert while rs is migrating: take part in the migration, then flush the node's probe
+        // sequence out of the old table so it can't be inserted twice, then insert into the new one
+        node_handle insert_resizing(resize_state* rs, uint32_t level, node_handle lo, node_handle hi, node_handle& new_handle)
+        {
+            help_migrate(rs);
 
-    public:
-        uint32_t var;
-        node_handle lo;
-        node_handle hi;
+            uint64_t h = hash(level, lo, hi);
+            uint32_t fp = fingerprint(h);
+            uint32_t b = uint32_t(h) & rs->from->mask;
 
-        make_node_task(robdd* bdd, node_handle bdd1, node_handle bdd2, uint32_t op, node_handle* n)
-            : m_bdd(bdd)
-            , m_bdd1(bdd1)
-            , m_bdd2(bdd2)
-            , m_op(op)
-            , m_n(n)
-        { }
+            for (;;)
+            {
+                for (uint32_t k = 0; k < bucket_entries; k++)
+                {
+                    uint64_t e = rs->from->buckets[b].entries[k].load(std::memory_order_acquire);
+                    if (entry_fingerprint(e) == fp && node_matches(entry_handle(e), level, lo, hi))
+                    {
+                        return entry_handle(e);
+                    }
 
-        tbb::task* execute() override
-        {
-            *m_n = m_bdd->make_node(var, lo, hi);
-            m_bdd->computedtb.insert(m_bdd1, m_bdd2, m_op, *m_n);
-            return NULL;
-        }
-    };
+                    if (migrate_entry(rs, b, k))
+                    {
+                        return insert_into(rs->to, level, lo, hi, new_handle);
+                    }
+                }
 
-    class apply_task : public tbb::task
-    {
-        robdd* m_bdd;
-        node_handle m_bdd1;
-        node_handle m_bdd2;
-        uint32_t m_op;
-        uint32_t m_level;
-        node_handle* m_n;
+                b = (b + 1) & rs->from->mask;
+            }
+        }
 
     public:
-        apply_task(robdd* bdd, node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level, node_handle* n)
-            : m_bdd(bdd)
-            , m_bdd1(bdd1)
-            , m_bdd2(bdd2)
-            , m_op(op)
-            , m_level(level)
-            , m_n(n)
-        { }
-
-        tbb::task* execute() override
+        unique_table()
         {
-            if (m_level >= m_bdd->max_level)
+            for (uint32_t s = 0; s < num_segments; s++)
             {
-                *m_n = m_bdd->apply_seq(m_bdd1, m_bdd2, m_op);
-                return NULL;
+                segments[s].store(nullptr, std::memory_order_relaxed);
             }
+            table.store(nullptr, std::memory_order_relaxed);
+            resizing.store(nullptr, std::memory_order_relaxed);
+        }
 
-            node_handle found = m_bdd->computedtb.find(m_bdd1, m_bdd2, m_op);
-            if (found != invalid_handle)
+        ~unique_table()
+        {
+            for (uint32_t s = 0; s < num_segments; s++)
             {
-                *m_n = found;
-                return NULL;
+                delete[] segments[s].load(std::memory_order_relaxed);
             }
+        }
 
-            // handle terminal vs terminal op
-            if ((m_bdd1 == m_bdd->false_node || m_bdd1 == m_bdd->true_node) &&
-                (m_bdd2 == m_bdd->false_node || m_bdd2 == m_bdd->true_node))
-            {
-                bool bdd1_value = m_bdd1 == m_bdd->true_node;
-                bool bdd2_value = m_bdd2 == m_bdd->true_node;
+        void init(uint32_t num_vars)
+        {
+            pool_head.store(0, std::memory_order_relaxed);
 
-                node_handle n;
+            num_free = 0;
+            free_head.store(0, std::memory_order_relaxed);
 
-                switch (m_op)
-                {
-                case opcode::bdd_and:
-                    n = (bdd1_value && bdd2_value) ? m_bdd->true_node : m_bdd->false_node;
-                    break;
-                case opcode::bdd_or:
-                    n = (bdd1_value || bdd2_value) ? m_bdd->true_node : m_bdd->false_node;
-                    break;
-                case opcode::bdd_xor:
-                    n = (bdd1_value != bdd2_value) ? m_bdd->true_node : m_bdd->false_node;
-                    break;
-                }
-                *m_n = n;
-                return NULL;
-            }
+            hash_table* t = new hash_table(initial_table_size);
+            tables.emplace_back(t);
+            table.store(t, std::memory_order_relaxed);
 
-            make_node_task& c = *new (allocate_continuation()) make_node_task(m_bdd, m_bdd1, m_bdd2, m_op, m_n);
+            // the one terminal node is true, and false is its complement
+            node_handle true_handle = pool_alloc() << 1;
+            node* true_node = to_node(true_handle);
+            assert(true_handle == get_true());
+            true_node->level.store(num_vars, std::memory_order_relaxed);
+            true_node->lo = true_node->hi = true_handle;
+        }
 
-            apply_task* a;
+        // the terminal is the first node in the pool
+        node_handle get_false() const
+        {
+            return complement(get_true());
+        }
 
-            if (m_bdd->get_var(m_bdd1) == m_bdd->get_var(m_bdd2))
-            {
-                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd->get_lo(m_bdd1), m_bdd->get_lo(m_bdd2), m_op, m_level + 1, &c.lo);
-                c.var = m_bdd->get_var(m_bdd1);
+        node_handle get_true() const
+        {
+            return 0;
+        }
 
-                m_bdd1 = m_bdd->get_hi(m_bdd1);
-                m_bdd2 = m_bdd->get_hi(m_bdd2);
-                m_level = m_level + 1;
-                m_n = &c.hi;
-            }
-            else if (m_bdd->get_var(m_bdd1) < m_bdd->get_var(m_bdd2))
-            {
-                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd->get_lo(m_bdd1), m_bdd2, m_op, m_level + 1, &c.lo);
-                c.var = m_bdd->get_var(m_bdd1);
+        uint32_t get_level(node_handle h) const
+        {
+            return to_node(h)->level.load(std::memory_order_relaxed);
+        }
 
-                m_bdd1 = m_bdd->get_hi(m_bdd1);
-                m_level = m_level + 1;
-                m_n = &c.hi;
-            }
-            else
-            {
-                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd1, m_bdd->get_lo(m_bdd2), m_op, m_level + 1, &c.lo);
-                c.var = m_bdd->get_var(m_bdd2);
+        node_handle get_lo(node_handle h) const
+        {
+            return to_node(h)->lo ^ (h & 1);
+        }
 
-                m_bdd2 = m_bdd->get_hi(m_bdd2);
-                m_level = m_level + 1;
-                m_n = &c.hi;
-            }
+        node_handle get_hi(node_handle h) const
+        {
+            return to_node(h)->hi ^ (h & 1);
+        }
 
-            recycle_as_child_of(c);
-            c.set_ref_count(2);
-            spawn(*a);
-            return this;
+        // number of pool slots currently holding a node, dead or alive
+        uint32_t num_allocated() const
+        {
+            uint32_t head = get_pool_size();
+            uint32_t reused = std::min(free_head.load(std::memory_order_relaxed), num_free);
+            return head - (num_free - reused);
         }
-    };
 
-    node_handle apply(node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level)
-    {
-        node_handle n;
-        tbb::task::spawn_root_and_wait(*new(tbb::task::allocate_root()) apply_task(this, bdd1, bdd2, op, level, &n));
-        return n;
-    }
+        uint32_t get_max_nodes() const
+        {
+            return max_nodes;
+        }
 
-    node_handle apply_seq(node_handle bdd1, node_handle bdd2, uint32_t op)
-    {
-        node_handle found = computedtb.find(bdd1, bdd2, op);
-        if (found != invalid_handle)
+        // one past the highest slot ever handed out
+        uint32_t get_pool_size() const
         {
-            return found;
+            uint32_t head = pool_head.load(std::memory_order_relaxed);
+            return head < max_nodes ? head : max_nodes;
         }
 
-        // handle terminal vs terminal op
-        if ((bdd1 == false_node || bdd1 == true_node) &&
-            (bdd2 == false_node || bdd2 == true_node))
+        // reclaims every node not set in marks: unmarked slots go on the free list,
+        // and the table is rebuilt from the marked nodes at a size that fits them.
+        // must not run concurrently with insert.
+        void sweep(const std::atomic<uint8_t>* marks)
         {
-            bool bdd1_value = bdd1 == true_node;
-            bool bdd2_value = bdd2 == true_node;
+            static const uint32_t chunk_size = 0x10000;
+
+            uint32_t head = get_pool_size();
+            uint32_t num_chunks = (head + chunk_size - 1) / chunk_size;
 
-            switch (op)
+            std::vector<uint32_t> chunk_free(num_chunks + 1);
+
+            tbb::parallel_for(uint32_t(0), num_chunks, [&](uint32_t c) {
+                uint32_t n = 0;
+                for (uint32_t i = c * chunk_size; i < std::min(head, (c + 1) * chunk_size); i++)
+                {
+                    if (!marks[i].load(std::memory_order_relaxed))
+                        n++;
+                }
+                chunk_free[c + 1] = n;
+            });
+
+            for (uint32_t c = 0; c < num_chunks; c++)
             {
-            case opcode::bdd_and:
-                return (bdd1_value && bdd2_value) ? true_node : false_node;
-            case opcode::bdd_or:
-                return (bdd1_value || bdd2_value) ? true_node : false_node;
-            case opcode::bdd_xor:
-                return (bdd1_value != bdd2_value) ? true_node : false_node;
+                chunk_free[c + 1] += chunk_free[c];
             }
-            return invalid_handle;
-        }
 
-        node_handle n;
+            num_free = chunk_free[num_chunks];
+            free_head.store(0, std::memory_order_relaxed);
+            free_list.reset(new node_handle[num_free]);
 
-        node_handle lo, hi;
-        if (get_var(bdd1) == get_var(bdd2))
-        {
-            lo = apply_seq(get_lo(bdd1), get_lo(bdd2), op);
-            hi = apply_seq(get_hi(bdd1), get_hi(bdd2), op);
-            n = make_node(get_var(bdd1), lo, hi);
+            // any migration in flight is abandoned, since the table is rebuilt from scratch
+            uint32_t table_size = initial_table_size;
+            while (table_size - table_size / 4 < 2 * (head - num_free))
+            {
+                table_size *= 2;
+            }
+
+            hash_table* t = new hash_table(table_size);
+            resizing.store(nullptr, std::memory_order_relaxed);
+            resizes.clear();
+            tables.clear();
+            tables.emplace_back(t);
+            table.store(t, std::memory_order_relaxed);
+
+            tbb::parallel_for(uint32_t(0), num_chunks, [&](uint32_t c) {
+                uint32_t n = chunk_free[c];
+                for (uint32_t i = c * chunk_size; i < std::min(head, (c + 1) * chunk_size); i++)
+                {
+                    if (!marks[i].load(std::memory_order_relaxed))
+                    {
+                        free_list[n++] = i;
+                    }
+                    else if (i != node_index(get_true()))
+                    {
+                        migrate_node(t, i << 1);
+                    }
+                }
+            });
         }
-        else if (get_var(bdd1) < get_var(bdd2))
+
+#ifdef PROBE_STATS
+        // average buckets scanned and nodes compared per insert
+        void get_probe_stats(double& buckets_per_lookup, double& compares_per_lookup)
         {
-            lo = apply_seq(get_lo(bdd1), bdd2, op);
-            hi = apply_seq(get_hi(bdd1), bdd2, op);
-            n = make_node(get_var(bdd1), lo, hi);
+            probe_stats total;
+            for (const probe_stats& ps : stats)
+            {
+                total.lookups += ps.lookups;
+                total.buckets += ps.buckets;
+                total.compares += ps.compares;
+            }
+            buckets_per_lookup = total.lookups ? double(total.buckets) / total.lookups : 0.0;
+            compares_per_lookup = total.lookups ? double(total.compares) / total.lookups : 0.0;
         }
-        else
+#endif
+
+        // reordering works on nodes directly: it allocates nodes without inserting them and rewrites
+        // live nodes in place, then a sweep rebuilds the table. must not run concurrently with insert.
+        node_handle alloc_node(uint32_t level, node_handle lo, node_handle hi)
         {
-            lo = apply_seq(bdd1, get_lo(bdd2), op);
-            hi = apply_seq(bdd1, get_hi(bdd2), op);
-            n = make_node(get_var(bdd2), lo, hi);
+            node_handle h = pool_alloc() << 1;
+            node* n = to_node(h);
+            n->level.store(level, std::memory_order_relaxed);
+            n->lo = lo;
+            n->hi = hi;
+            return h;
         }
 
-        computedtb.insert(bdd1, bdd2, op, n);
+        void set_level(node_handle h, uint32_t level)
+        {
+            to_node(h)->level.store(level, std::memory_order_relaxed);
+        }
 
-        return n;
-    }
-#else
-    node_handle apply(node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level)
-    {
-        node_handle found = computedtb.find(bdd1, bdd2, op);
-        if (found != invalid_handle)
+        void set_children(node_handle h, node_handle lo, node_handle hi)
         {
-            return found;
+            node* n = to_node(h);
+            n->lo = lo;
+            n->hi = hi;
         }
 
-        // handle terminal vs terminal op
-        if ((bdd1 == false_node || bdd1 == true_node) &&
-            (bdd2 == false_node || bdd2 == true_node))
+        std::atomic<uint32_t>& refs(node_handle h)
         {
-            bool bdd1_value = bdd1 == true_node;
-            bool bdd2_value = bdd2 == true_node;
+            return to_node(h)->refs;
+        }
 
-            switch (op)
+        node_handle insert(uint32_t level, node_handle lo, node_handle hi)
+        {
+            // canonical form has a regular hi edge, so store the complement and negate the handle
+            if (is_complemented(hi))
             {
-            case opcode::bdd_and:
-                return (bdd1_value && bdd2_value) ? true_node : false_node;
-            case opcode::bdd_or:
-                return (bdd1_value || bdd2_value) ? true_node : false_node;
-            case opcode::bdd_xor:
-                return (bdd1_value != bdd2_value) ? true_node : false_node;
+                return complement(insert(level, complement(lo), complement(hi)));
             }
-            return invalid_handle;
-        }
 
-        node_handle n;
+#ifdef PROBE_STATS
+            stats.local().lookups++;
+#endif
 
-#ifndef SINGLETHREADED
-        if (level < max_level)
-        {
-            tbb::task_group g;
-            node_handle lo, hi;
+            node_handle new_handle = invalid_handle;
 
-            if (get_var(bdd1) == get_var(bdd2))
+            for (;;)
             {
-                g.run([&] { lo = apply(get_lo(bdd1), get_lo(bdd2), op, level + 1); });
-                g.run_and_wait([&] { hi = apply(get_hi(bdd1), get_hi(bdd2), op, level + 1); });
-                n = make_node(get_var(bdd1), lo, hi);
+                node_handle h;
+
+                resize_state* rs = resizing.load(std::memory_order_acquire);
+                if (rs)
+                {
+                    h = insert_resizing(rs, level, lo, hi, new_handle);
+                }
+                else
+                {
+                    h = insert_into(table.load(std::memory_order_acquire), level, lo, hi, new_handle);
+                }
+
+                if (h != invalid_handle)
+                {
+                    return h;
+                }
             }
-            else if (get_var(bdd1) < get_var(bdd2))
-            {
-                g.run([&] { lo = apply(get_lo(bdd1), bdd2, op, level + 1); });
-                g.run_and_wait([&] { hi = apply(get_hi(bdd1), bdd2, op, level + 1); });
-                n = make_node(get_var(bdd1), lo, hi);
+        }
+    };
+
+    // a lossy cache of operation results, keyed by an op and arity operand handles, in buckets that
+    // fill a cache line. every entry is a seqlock: its version is odd while a writer is filling it in,
+    // and a reader that sees the version change under it treats the entry as a miss, so lookups are
+    // plain loads. a writer that finds an entry busy just drops its result.
+    template<int arity>
+    class computed_table
+    {
+    public:
+        using key = std::array<node_handle, arity>;
+
+    private:
+        struct ctnode
+        {
+            // version above, then the referenced bit, then op + 1 in the low bits so that 0 is an empty entry
+            std::atomic<uint32_t> seq_op;
+            std::atomic<node_handle> operands[arity];
+            std::atomic<node_handle> result;
+        };
+
+        static const uint32_t bucket_entries = 64 / sizeof(ctnode);
+
+        struct alignas(64) bucket
+        {
+            ctnode entries[bucket_entries];
+        };
+
+        static const uint32_t op_mask = 0x7F;
+        // set by hits and cleared by inserts passing over the entry, which evict the first entry without it.
+        // it isn't part of the version, so flipping it doesn't make readers miss.
+        static const uint32_t referenced = 0x80;
+        static const uint32_t seq_one = 0x100;
+
+        void* memory;
+        bucket* buckets;
+        // mask of bucket indices
+        uint32_t mask;
+
+        // the table starts at initial_buckets and grows with the number of live nodes up to max_buckets
+        uint32_t initial_buckets;
+        uint32_t max_buckets;
+
+#ifdef PROBE_STATS
+        struct hit_stats
+        {
+            uint64_t lookups = 0;
+            uint64_t hits = 0;
+        };
+
+        tbb::enumerable_thread_specific<hit_stats> stats;
+#endif
+
+        static uint32_t hash(const key& k, uint32_t op)
+        {
+            uint32_t h = op;
+            for (node_handle operand : k)
+            {
+                h += operand;
             }
-            else
+            return h;
+        }
+
+        static bool is_writing(uint32_t seq_op)
+        {
+            return (seq_op & seq_one) != 0;
+        }
+
+        static bool matches(const ctnode& e, const key& k)
+        {
+            for (int i = 0; i < arity; i++)
             {
-                g.run([&] { lo = apply(bdd1, get_lo(bdd2), op, level + 1); });
-                g.run_and_wait([&] { hi = apply(bdd1, get_hi(bdd2), op, level + 1); });
-                n = make_node(get_var(bdd2), lo, hi);
+                if (e.operands[i].load(std::memory_order_relaxed) != k[i])
+                    return false;
             }
+            return true;
         }
-        else
-#endif
+
+        static key entry_key(const ctnode& e)
         {
-            node_handle lo, hi;
-            if (get_var(bdd1) == get_var(bdd2))
+            key k;
+            for (int i = 0; i < arity; i++)
             {
-                lo = apply(get_lo(bdd1), get_lo(bdd2), op, level);
-                hi = apply(get_hi(bdd1), get_hi(bdd2), op, level);
-                n = make_node(get_var(bdd1), lo, hi);
+                k[i] = e.operands[i].load(std::memory_order_relaxed);
             }
-            else if (get_var(bdd1) < get_var(bdd2))
+            return k;
+        }
+
+        void allocate(uint32_t num_buckets)
+        {
+            // calloc hands back zeroed entries, which are empty
+            static_assert(sizeof(bucket) == 64, "buckets must be one cache line");
+            memory = std::calloc(size_t(num_buckets) * sizeof(bucket) + 63, 1);
+            if (!memory)
             {
-                lo = apply(get_lo(bdd1), bdd2, op, level);
-                hi = apply(get_hi(bdd1), bdd2, op, level);
-                n = make_node(get_var(bdd1), lo, hi);
+                printf("computed_table allocation failed\n");
+                std::abort();
             }
-            else
+            buckets = (bucket*)(((uintptr_t)memory + 63) & ~uintptr_t(63));
+            mask = num_buckets - 1;
+        }
+
+        bool entry_is_live(const ctnode& e, const std::atomic<uint8_t>* marks, uint64_t transient_ops) const
+        {
+            uint32_t op_plus_one = e.seq_op.load(std::memory_order_relaxed) & op_mask;
+            if (op_plus_one == 0 || (transient_ops >> (op_plus_one - 1)) & 1)
+                return false;
+
+            for (int i = 0; i < arity; i++)
             {
-                lo = apply(bdd1, get_lo(bdd2), op, level);
-                hi = apply(bdd1, get_hi(bdd2), op, level);
-                n = make_node(get_var(bdd2), lo, hi);
+                if (!marks[node_index(e.operands[i].load(std::memory_order_relaxed))].load(std::memory_order_relaxed))
+                    return false;
             }
+
+            return marks[node_index(e.result.load(std::memory_order_relaxed))].load(std::memory_order_relaxed) != 0;
         }
 
-        computedtb.insert(bdd1, bdd2, op, n);
+    public:
+        computed_table(uint32_t initial_buckets, uint32_t max_buckets)
+            : initial_buckets(initial_buckets)
+            , max_buckets(max_buckets)
+        {
+            allocate(initial_buckets);
+        }
 
-        return n;
-    }
+        ~computed_table()
+        {
+            std::free(memory);
+        }
+
+        // caps the table at about max_bytes. must not run concurrently with find or insert.
+        void set_budget(size_t max_bytes)
+        {
+            max_buckets = 1;
+            while (max_buckets < 0x40000000 && size_t(max_buckets) * 2 * sizeof(bucket) <= max_bytes)
+            {
+                max_buckets *= 2;
+            }
+
+            if (mask + 1 > max_buckets)
+            {
+                std::free(memory);
+                allocate(max_buckets);
+            }
+        }
+
+        // drops every entry that refers to a node not set in marks, and resizes the table to fit
+        // num_live_nodes within the budget. entries of the ops set in transient_ops are dropped too,
+        // which is for ops whose operands aren't all nodes. must not run concurrently with find or insert.
+        void sweep(const std::atomic<uint8_t>* marks, uint32_t num_live_nodes, uint64_t transient_ops = 0)
+        {
+            uint32_t num_buckets = mask + 1;
+            while (size_t(num_buckets) * bucket_entries < num_live_nodes && num_buckets < max_buckets)
+            {
+                num_buckets *= 2;
+            }
+            while (num_buckets > max_buckets)
+            {
+                num_buckets /= 2;
+            }
+
+            if (num_buckets == mask + 1)
+            {
+                tbb::parallel_for(tbb::blocked_range<uint32_t>(0, mask + 1), [&](const tbb::blocked_range<uint32_t>& range) {
+                    for (uint32_t b = range.begin(); b != range.end(); b++)
+                    {
+                        for (ctnode& e : buckets[b].entries)
+                        {
+                            if (!entry_is_live(e, marks, transient_ops))
+                            {
+                                e.seq_op.store(e.seq_op.load(std::memory_order_relaxed) & ~(op_mask | referenced), std::memory_order_relaxed);
+                            }
+                        }
+                    }
+                });
+                return;
+            }
+
+            void* old_memory = memory;
+            bucket* old_buckets = buckets;
+            uint32_t old_num_buckets = mask + 1;
+
+            allocate(num_buckets);
+
+            auto reinsert = [&](uint32_t begin, uint32_t end) {
+                for (uint32_t b = begin; b != end; b++)
+                {
+                    for (const ctnode& e : old_buckets[b].entries)
+                    {
+                        if (entry_is_live(e, marks, transient_ops))
+                        {
+                            insert(entry_key(e), (e.seq_op.load(std::memory_order_relaxed) & op_mask) - 1, e.result.load(std::memory_order_relaxed));
+                        }
+                    }
+                }
+            };
+
+            // concurrent inserts are only safe with the seqlock
+#ifndef SINGLETHREADED
+            tbb::parallel_for(tbb::blocked_range<uint32_t>(0, old_num_buckets), [&](const tbb::blocked_range<uint32_t>& range) {
+                reinsert(range.begin(), range.end());
+            });
+#else
+            reinsert(0, old_num_buckets);
 #endif
-};
 
-struct bdd_instr
-{
-    enum {
-        opcode_newinput,
-        opcode_and,
-        opcode_or,
-        opcode_xor,
-        opcode_not
-    };
+            std::free(old_memory);
+        }
 
-    int opcode;
+        node_handle find(const key& k, uint32_t op)
+        {
+            bucket& b = buckets[hash(k, op) & mask];
 
-    union
-    {
-        struct {
-            int operand_newinput_ast_id;
-            int operand_newinput_var_id;
-            const std::string* operand_newinput_name;
-        };
+#ifdef PROBE_STATS
+            hit_stats& hs = stats.local();
+            hs.lookups++;
+#endif
 
-        struct {
-            int operand_and_dst_id;
-            int operand_and_src1_id;
-            int operand_and_src2_id;
-        };
+            for (ctnode& e : b.entries)
+            {
+                uint32_t seq_op = e.seq_op.load(std::memory_order_acquire);
+                if (is_writing(seq_op) || (seq_op & op_mask) != op + 1)
+                {
+                    continue;
+                }
 
-        struct {
-            int operand_or_dst_id;
-            int operand_or_src1_id;
-            int operand_or_src2_id;
-        };
+                bool match = matches(e, k);
+                node_handle result = e.result.load(std::memory_order_relaxed);
 
-        struct {
-            int operand_xor_dst_id;
-            int operand_xor_src1_id;
-            int operand_xor_src2_id;
-        };
+#ifndef SINGLETHREADED
+                // pairs with the writer's release fence: if any of the loads above saw its stores, this sees its version
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if ((e.seq_op.load(std::memory_order_relaxed) ^ seq_op) & ~referenced)
+                {
+                    continue;
+                }
+#endif
 
-        struct {
-            int operand_not_dst_id;
-            int operand_not_src_id;
-        };
+                if (match)
+                {
+                    if (!(seq_op & referenced))
+                    {
+                        e.seq_op.fetch_or(referenced, std::memory_order_relaxed);
+                    }
+#ifdef PROBE_STATS
+                    hs.hits++;
+#endif
+                    return result;
+                }
+            }
 
-        struct {
-            int operand_dontcare_dst_id;
-            int operand_dontcare_src_id;
-        };
-    };
-};
+            return invalid_handle;
+        }
 
-enum {
-    ast_id_false,
-    ast_id_true,
-    ast_id_user
-};
+        void insert(const key& k, uint32_t op, node_handle r)
+        {
+            bucket& b = buckets[hash(k, op) & mask];
 
-void decode(
-    int num_instrs, bdd_instr* instrs,
-    int num_user_ast_nodes,
-    int num_root_ast_ids, int* root_ast_ids,
-    robdd* r,
-    robdd::node_handle* roots)
-{
-#ifdef ITTPROFILE
-    __itt_task_begin(robdd_itt_domain, __itt_null, __itt_null, robdd_itt_decode_task);
+            // an entry for the same operation if another thread got there first, else an empty entry,
+            // else the first one that wasn't hit since the last insert passed it
+            ctnode* victim = nullptr;
+            for (ctnode& e : b.entries)
+            {
+                uint32_t seq_op = e.seq_op.load(std::memory_order_relaxed);
+                if ((seq_op & op_mask) == 0 || ((seq_op & op_mask) == op + 1 && matches(e, k)))
+                {
+                    victim = &e;
+                    break;
+                }
+            }
+            if (!victim)
+            {
+                for (ctnode& e : b.entries)
+                {
+                    uint32_t seq_op = e.seq_op.load(std::memory_order_relaxed);
+                    if (!(seq_op & referenced))
+                    {
+                        victim = &e;
+                        break;
+                    }
+                    e.seq_op.fetch_and(~referenced, std::memory_order_relaxed);
+                }
+            }
+            if (!victim)
+            {
+                // everything was hit, and now nothing is
+                victim = &b.entries[0];
+            }
+
+            ctnode& e = *victim;
+
+            uint32_t seq_op = e.seq_op.load(std::memory_order_relaxed);
+            uint32_t seq = seq_op & ~(op_mask | referenced);
+
+#ifndef SINGLETHREADED
+            if (is_writing(seq_op) || !e.seq_op.compare_exchange_strong(seq_op, (seq + seq_one) | (op + 1), std::memory_order_relaxed))
+            {
+                return;
+            }
+
+            // keeps the field stores below from becoming visible before the odd version
+            std::atomic_thread_fence(std::memory_order_release);
 #endif
 
-    robdd::node_handle false_node = r->get_false();
-    robdd::node_handle true_node = r->get_true();
+            for (int i = 0; i < arity; i++)
+            {
+                e.operands[i].store(k[i], std::memory_order_relaxed);
+            }
+            e.result.store(r, std::memory_order_relaxed);
 
-    std::vector<robdd::node_handle> astnode2bddnode(ast_id_user + num_user_ast_nodes);
-    astnode2bddnode[ast_id_false] = false_node;
-    astnode2bddnode[ast_id_true] = true_node;
+#ifdef SINGLETHREADED
+            e.seq_op.store(seq | (op + 1), std::memory_order_relaxed);
+#else
+            e.seq_op.store((seq + 2 * seq_one) | (op + 1), std::memory_order_release);
+#endif
+        }
 
-    for (int root_ast_idx = 0; root_ast_idx < num_root_ast_ids; root_ast_idx++)
+#ifdef PROBE_STATS
+        double get_hit_rate()
+        {
+            hit_stats total;
+            for (const hit_stats& hs : stats)
+            {
+                total.lookups += hs.lookups;
+                total.hits += hs.hits;
+            }
+            return total.lookups ? double(total.hits) / total.lookups : 0.0;
+        }
+#endif
+    };
+
+    unique_table uniquetb;
+
+    node_handle false_node;
+    node_handle true_node;
+
+    // in buckets. the ternary table starts smaller, since scripts build most things with apply.
+    static const uint32_t computed_initial_buckets = 0x40000;
+    static const uint32_t computed_max_buckets = 0x800000;
+    static const uint32_t ternary_initial_buckets = 0x10000;
+    static const uint32_t ternary_max_buckets = 0x200000;
+
+    computed_table<2> computedtb;
+    computed_table<3> ternarytb;
+
+    uint32_t max_level;
+
+    // apply runs as tbb::task continuations rather than task_group recursion
+    bool apply_tasks;
+
+    // collect_garbage is only worth running once this many nodes are allocated
+    static const uint32_t gc_min_nodes = 0x100000;
+
+    uint32_t gc_threshold;
+
+    uint32_t peak_nodes;
+
+    // what compose replaces every variable with, which only lives as long as the call
+    struct substitution
+    {
+        // keys the computed table, so that results of different calls don't mix
+        node_handle id;
+        // the function that replaces the variable at each level, or invalid_handle to keep it
+        std::vector<node_handle> by_level;
+        // the lowest level with a replacement. nothing below it changes.
+        uint32_t bottom;
+    };
+
+    std::atomic<node_handle> next_substitution_id;
+
+    void mark(node_handle h, std::atomic<uint8_t>* marks, uint32_t level)
     {
-        if (root_ast_ids[root_ast_idx] == ast_id_true)
-            roots[root_ast_idx] = true_node;
-        else if (root_ast_ids[root_ast_idx] == ast_id_false)
-            roots[root_ast_idx] = false_node;
+        if (marks[node_index(h)].exchange(1, std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        if (level < max_level)
+        {
+            tbb::task_group g;
+            g.run([&] { mark(get_lo(h), marks, level + 1); });
+            g.run_and_wait([&] { mark(get_hi(h), marks, level + 1); });
+        }
+        else
+        {
+            mark(get_lo(h), marks, level);
+            mark(get_hi(h), marks, level);
+        }
     }
 
-    robdd::node_handle* ast2bdd = astnode2bddnode.data();
+    // one mark per pool slot, set for the terminal and every node reachable from roots
+    std::unique_ptr<std::atomic<uint8_t>[]> mark_live(int num_roots, const node_handle* roots)
+    {
+        std::unique_ptr<std::atomic<uint8_t>[]> marks(new std::atomic<uint8_t>[uniquetb.get_pool_size()]);
 
-    for (int i = 0; i < num_instrs; i++)
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, uniquetb.get_pool_size()), [&](const tbb::blocked_range<uint32_t>& range) {
+            for (uint32_t i = range.begin(); i != range.end(); i++)
+            {
+                marks[i].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        marks[node_index(true_node)].store(1, std::memory_order_relaxed);
+
+        tbb::parallel_for(0, num_roots, [&](int i) {
+            if (roots[i] != invalid_handle)
+            {
+                mark(roots[i], marks.get(), 0);
+            }
+        });
+
+        return marks;
+    }
+
+    // level2var[l] is the input variable tested by the nodes at level l, and var2level is its inverse.
+    // the terminal sits at level num_vars, below every variable.
+    std::vector<uint32_t> level2var;
+    std::vector<uint32_t> var2level;
+
+    bool reorder_enabled;
+
+    // reordering is first tried once this many nodes are allocated
+    static const uint32_t reorder_min_nodes = 0x10000;
+
+    uint32_t reorder_threshold;
+
+    // sifting over the live nodes, with the levels split into blocks that are sifted in parallel.
+    // a block only swaps its own levels and only edits the subtables of its own levels, so blocks
+    // share nothing but the reference counts and levels of the nodes below them.
+    class sifter
     {
-        const bdd_instr& inst = instrs[i];
+        using subtable = std::unordered_map<uint64_t, node_handle>;
 
-        // initial level of depth
-        uint32_t level = 0;
+        // a block is not worth its own thread with fewer levels than this
+        static const uint32_t min_block_levels = 8;
 
-        int inst_dst_ast_id = -1;
-        robdd::node_handle inst_dst_node = robdd::invalid_handle;
+        robdd& r;
+        unique_table& ut;
+        uint32_t num_levels;
 
-        switch (inst.opcode)
-        {
-        case bdd_instr::opcode_newinput:
+        // the live nodes of each level, keyed by their children
+        std::vector<subtable> subtables;
+
+        static uint64_t key(node_handle lo, node_handle hi)
         {
-            int ast_id = inst.operand_newinput_ast_id;
-            int var_id = inst.operand_newinput_var_id;
-            const char* ast_name = inst.operand_newinput_name->c_str();
+            return (uint64_t(lo) << 32) | hi;
+        }
 
-#ifdef SHOW_INSTRS
+        bool is_terminal(node_handle h) const
+        {
+            return node_index(h) == node_index(r.true_node);
+        }
+
+        void ref(node_handle h)
+        {
+            if (!is_terminal(h))
+            {
+                ut.refs(h).fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // drops a reference, and deletes the node if it was the last one. a node below the block belongs
+        // to another block, so it is left for that block to drop when it next swaps the node's level,
+        // or for the collection that follows reordering.
+        void deref(node_handle h, uint32_t block_end)
+        {
+            if (is_terminal(h) || ut.refs(h).fetch_sub(1, std::memory_order_relaxed) != 1)
+            {
+                return;
+            }
+
+            uint32_t level = ut.get_level(h);
+            if (level < block_end)
+            {
+                h = regular(h);
+                subtables[level].erase(key(ut.get_lo(h), ut.get_hi(h)));
+                deref_children(h, block_end);
+            }
+        }
+
+        void deref_children(node_handle h, uint32_t block_end)
+        {
+            deref(ut.get_lo(h), block_end);
+            deref(ut.get_hi(h), block_end);
+        }
+
+        bool is_dead(node_handle h)
+        {
+            return ut.refs(h).load(std::memory_order_relaxed) == 0;
+        }
+
+        // finds or creates the node (level, lo, hi) in t and takes a reference to it
+        node_handle make(subtable& t, uint32_t level, node_handle lo, node_handle hi)
+        {
+            if (lo == hi)
+            {
+                ref(lo);
+                return lo;
+            }
+
+            node_handle c = hi & 1;
+            lo ^= c;
+            hi ^= c;
+
+            auto found = t.find(key(lo, hi));
+            if (found != t.end())
+            {
+                ref(found->second);
+                return found->second ^ c;
+            }
+
+            node_handle h = ut.alloc_node(level, lo, hi);
+            ut.refs(h).store(1, std::memory_order_relaxed);
+            ref(lo);
+            ref(hi);
+            t.emplace(key(lo, hi), h);
+            return h ^ c;
+        }
+
+        // exchanges the variables of levels i and i + 1. nodes at level i that don't depend on the
+        // variable below just move down, and the others are rewritten in place into nodes of the
+        // lower variable, so every handle held outside keeps its meaning.
+        void swap(uint32_t i, uint32_t block_end)
+        {
+            subtable upper;
+            subtable lower;
+            std::vector<node_handle> interacting;
+
+            for (auto& e : subtables[i])
+            {
+                node_handle h = e.second;
+                if (is_dead(h))
+                {
+                    deref_children(h, block_end);
+                }
+                else if (ut.get_level(ut.get_lo(h)) == i + 1 || ut.get_level(ut.get_hi(h)) == i + 1)
+                {
+                    interacting.push_back(h);
+                }
+                else
+                {
+                    ut.set_level(h, i + 1);
+                    lower.emplace(e.first, h);
+                }
+            }
+
+            for (node_handle h : interacting)
+            {
+                node_handle f0 = ut.get_lo(h);
+                node_handle f1 = ut.get_hi(h);
+
+                node_handle f00 = f0, f01 = f0;
+                if (ut.get_level(f0) == i + 1)
+                {
+                    f00 = ut.get_lo(f0);
+                    f01 = ut.get_hi(f0);
+                }
+
+                node_handle f10 = f1, f11 = f1;
+                if (ut.get_level(f1) == i + 1)
+                {
+                    f10 = ut.get_lo(f1);
+                    f11 = ut.get_hi(f1);
+                }
+
+                // f1 is regular, so g1 is too and h stays canonical
+                node_handle g0 = make(lower, i + 1, f00, f10);
+                node_handle g1 = make(lower, i + 1, f01, f11);
+
+                ut.set_children(h, g0, g1);
+                upper.emplace(key(g0, g1), h);
+
+                deref(f0, block_end);
+                deref(f1, block_end);
+            }
+
+            for (auto& e : subtables[i + 1])
+            {
+                node_handle h = e.second;
+                if (is_dead(h))
+                {
+                    deref_children(h, block_end);
+                }
+                else
+                {
+                    ut.set_level(h, i);
+                    upper.emplace(e.first, h);
+                }
+            }
+
+            subtables[i].swap(upper);
+            subtables[i + 1].swap(lower);
+
+            std::swap(r.level2var[i], r.level2var[i + 1]);
+            r.var2level[r.level2var[i]] = i;
+            r.var2level[r.level2var[i + 1]] = i + 1;
+        }
+
+        size_t block_size(uint32_t begin, uint32_t end) const
+        {
+            size_t size = 0;
+            for (uint32_t level = begin; level < end; level++)
+            {
+                size += subtables[level].size();
+            }
+            return size;
+        }
+
+        // moves each variable of the block through every level of the block, and leaves it where the block was smallest
+        void sift_block(uint32_t begin, uint32_t end)
+        {
+            if (end - begin < 2)
+            {
+                return;
+            }
+
+            // the variables with the most nodes go first
+            std::vector<uint32_t> vars(r.level2var.begin() + begin, r.level2var.begin() + end);
+            std::sort(vars.begin(), vars.end(), [&](uint32_t a, uint32_t b) {
+                return subtables[r.var2level[a]].size() > subtables[r.var2level[b]].size();
+            });
+
+            for (uint32_t var : vars)
+            {
+                uint32_t level = r.var2level[var];
+                size_t best_size = block_size(begin, end);
+                uint32_t best_level = level;
+
+                auto sift_to = [&](uint32_t target)
+                {
+                    while (level != target)
+                    {
+                        if (level < target)
+                        {
+                            swap(level, end);
+                            level++;
+                        }
+                        else
+                        {
+                            level--;
+                            swap(level, end);
+                        }
+
+                        size_t size = block_size(begin, end);
+                        if (size < best_size)
+                        {
+                            best_size = size;
+                            best_level = level;
+                        }
+                        else if (size * 5 > best_size * 6)
+                        {
+                            // more than 20% bigger than the best so far, so don't look any further this way
+                            return;
+                        }
+                    }
+                };
+
+                // nearest end of the block first
+                if (level - begin < end - 1 - level)
+                {
+                    sift_to(begin);
+                    sift_to(end - 1);
+                }
+                else
+                {
+                    sift_to(end - 1);
+                    sift_to(begin);
+                }
+
+                for (; level < best_level; level++)
+                {
+                    swap(level, end);
+                }
+                while (level > best_level)
+                {
+                    level--;
+                    swap(level, end);
+                }
+            }
+        }
+
+    public:
+        sifter(robdd& r, const std::atomic<uint8_t>* marks, int num_roots, const node_handle* roots)
+            : r(r)
+            , ut(r.uniquetb)
+            , num_levels((uint32_t)r.var2level.size())
+            , subtables(num_levels)
+        {
+            uint32_t pool_size = ut.get_pool_size();
+            uint32_t terminal = node_index(r.true_node);
+
+            tbb::parallel_for(tbb::blocked_range<uint32_t>(0, pool_size), [&](const tbb::blocked_range<uint32_t>& range) {
+                for (uint32_t i = range.begin(); i != range.end(); i++)
+                {
+                    if (i != terminal && marks[i].load(std::memory_order_relaxed))
+                    {
+                        ut.refs(i << 1).store(0, std::memory_order_relaxed);
+                    }
+                }
+            });
+
+            tbb::parallel_for(tbb::blocked_range<uint32_t>(0, pool_size), [&](const tbb::blocked_range<uint32_t>& range) {
+                for (uint32_t i = range.begin(); i != range.end(); i++)
+                {
+                    if (i != terminal && marks[i].load(std::memory_order_relaxed))
+                    {
+                        ref(ut.get_lo(i << 1));
+                        ref(ut.get_hi(i << 1));
+                    }
+                }
+            });
+
+            for (int i = 0; i < num_roots; i++)
+            {
+                if (roots[i] != invalid_handle)
+                {
+                    ref(roots[i]);
+                }
+            }
+
+            for (uint32_t i = 0; i < pool_size; i++)
+            {
+                if (i != terminal && marks[i].load(std::memory_order_relaxed))
+                {
+                    node_handle h = i << 1;
+                    subtables[ut.get_level(h)].emplace(key(ut.get_lo(h), ut.get_hi(h)), h);
+                }
+            }
+        }
+
+        void sift(uint32_t num_threads)
+        {
+            uint32_t num_blocks = std::max(std::min(num_threads, num_levels / min_block_levels), 1u);
+            uint32_t block_levels = (num_levels + num_blocks - 1) / num_blocks;
+
+            // the second pass shifts the block boundaries by half a block, so variables can cross the first pass's
+            int num_passes = num_blocks > 1 ? 2 : 1;
+            for (int pass = 0; pass < num_passes; pass++)
+            {
+                std::vector<uint32_t> bounds(1, 0);
+                for (uint32_t b = pass == 0 ? block_levels : block_levels / 2; b < num_levels; b += block_levels)
+                {
+                    bounds.push_back(b);
+                }
+                bounds.push_back(num_levels);
+
+                tbb::parallel_for(size_t(0), bounds.size() - 1, [&](size_t b) {
+                    sift_block(bounds[b], bounds[b + 1]);
+                });
+            }
+        }
+    };
+
+public:
+    robdd(uint32_t num_vars, int num_threads = -1)
+        : computedtb(computed_initial_buckets, computed_max_buckets)
+        , ternarytb(ternary_initial_buckets, ternary_max_buckets)
+    {
+        uniquetb.init(num_vars);
+
+        false_node = uniquetb.get_false();
+        true_node = uniquetb.get_true();
+
+        max_level = ((num_threads == -1 ? tbb::this_task_arena::max_concurrency() : num_threads) - 1) * 2;
+#ifdef SINGLETHREADED
+        max_level = 0;
+#endif
+
+        gc_threshold = gc_min_nodes;
+        peak_nodes = 0;
+        next_substitution_id = 0;
+
+        level2var.resize(num_vars + 1);
+        var2level.resize(num_vars);
+        for (uint32_t var = 0; var < num_vars; var++)
+        {
+            level2var[var] = var;
+            var2level[var] = var;
+        }
+        level2var[num_vars] = num_vars;
+
+        reorder_enabled = false;
+        reorder_threshold = reorder_min_nodes;
+
+        apply_tasks = false;
+    }
+
+    // off by default
+    void enable_reordering(bool enable)
+    {
+        reorder_enabled = enable;
+    }
+
+#ifdef HAVE_APPLY_TASK
+    // the older apply built on tbb::task, kept to compare against the task_group one
+    void enable_apply_tasks(bool enable)
+    {
+        apply_tasks = enable;
+    }
+#endif
+
+    // true once the nodes have grown enough since the last reordering to try again
+    bool should_reorder() const
+    {
+        return reorder_enabled && uniquetb.num_allocated() >= reorder_threshold;
+    }
+
+    // looks for a smaller variable order by sifting, then collects garbage. handles of nodes reachable
+    // from roots stay valid and keep their meaning, and so do computed results. must not run concurrently with apply.
+    void reorder(int num_roots, const node_handle* roots)
+    {
+        {
+            std::unique_ptr<std::atomic<uint8_t>[]> marks = mark_live(num_roots, roots);
+            sifter s(*this, marks.get(), num_roots, roots);
+            marks.reset();
+
+            s.sift(max_level / 2 + 1);
+        }
+
+        collect_garbage(num_roots, roots);
+
+        reorder_threshold = std::max(uniquetb.num_allocated() * 2, uint32_t(reorder_min_nodes));
+    }
+
+    // true once enough nodes have been allocated since the last collection to make one worthwhile
+    bool should_collect_garbage() const
+    {
+        return uniquetb.num_allocated() >= gc_threshold;
+    }
+
+    // frees every node not reachable from roots, and forgets computed results that refer to them.
+    // handles of reachable nodes stay valid. must not run concurrently with apply.
+    void collect_garbage(int num_roots, const node_handle* roots)
+    {
+        // nothing is freed between collections, so this is where the peak is
+        peak_nodes = std::max(peak_nodes, uniquetb.num_allocated());
+
+        std::unique_ptr<std::atomic<uint8_t>[]> marks = mark_live(num_roots, roots);
+
+        uniquetb.sweep(marks.get());
+
+        // let the live set double before collecting again, but don't wait for the pool to run dry
+        uint32_t live = uniquetb.num_allocated();
+
+        // substitution ids are never reused, so results from past compose calls can't hit anyway
+        computedtb.sweep(marks.get(), live, uint64_t(1) << opcode::bdd_compose);
+        ternarytb.sweep(marks.get(), live / 4);
+
+        uint32_t capacity = uniquetb.get_max_nodes();
+        gc_threshold = std::max(live * 2, uint32_t(gc_min_nodes));
+        if (gc_threshold > capacity - capacity / 8)
+        {
+            gc_threshold = live + (capacity - live) / 2;
+        }
+    }
+
+#ifdef PROBE_STATS
+    void get_probe_stats(double& buckets_per_lookup, double& compares_per_lookup)
+    {
+        uniquetb.get_probe_stats(buckets_per_lookup, compares_per_lookup);
+    }
+
+    double get_computed_hit_rate()
+    {
+        return computedtb.get_hit_rate();
+    }
+
+    double get_ternary_hit_rate()
+    {
+        return ternarytb.get_hit_rate();
+    }
+#endif
+
+    // caps the memory of the computed table, which otherwise grows with the number of live nodes.
+    // the ternary table gets a quarter of that on top.
+    void set_computed_table_budget(size_t max_bytes)
+    {
+        computedtb.set_budget(max_bytes);
+        ternarytb.set_budget(max_bytes / 4);
+    }
+
+    // the most nodes that have been allocated at once, dead or alive
+    uint32_t get_peak_nodes() const
+    {
+        return std::max(peak_nodes, uniquetb.num_allocated());
+    }
+
+    node_handle get_false() const
+    {
+        return false_node;
+    }
+
+    node_handle get_true() const
+    {
+        return true_node;
+    }
+
+    // the input variable tested by a node
+    uint32_t get_var(node_handle h) const
+    {
+        return level2var[uniquetb.get_level(h)];
+    }
+
+    // the position of a node's variable in the current order, which only changes when reordering
+    uint32_t get_level(node_handle h) const
+    {
+        return uniquetb.get_level(h);
+    }
+
+    // the input variable at a level of the current order
+    uint32_t get_level_var(uint32_t level) const
+    {
+        return level2var[level];
+    }
+
+    node_handle get_lo(node_handle h) const
+    {
+        return uniquetb.get_lo(h);
+    }
+
+    node_handle get_hi(node_handle h) const
+    {
+        return uniquetb.get_hi(h);
+    }
+
+    // O(1) thanks to complement edges
+    node_handle negate(node_handle h) const
+    {
+        return complement(h);
+    }
+
+    node_handle make_node(uint32_t level, node_handle lo, node_handle hi)
+    {
+        // enforce no-redundance constraint of ROBDD
+        if (lo == hi) return lo;
+        // enforce uniqueness constraint of ROBDD
+        // hash table returns the node if it exists
+        // and inserts the node if it doesn't
+        return uniquetb.insert(level, lo, hi);
+    }
+
+    // the bdd of a single input variable, at whatever level the variable currently sits
+    node_handle make_var(uint32_t var)
+    {
+        return make_node(var2level[var], false_node, true_node);
+    }
+
+    // rewrites an operation into the form that gets computed and cached: OR becomes an AND of the
+    // complements, and complements are pulled out of XOR's operands. returns the complement bit that
+    // the result of the rewritten operation must be XORed with.
+    static node_handle normalize(node_handle& bdd1, node_handle& bdd2, uint32_t& op)
+    {
+        node_handle result_complement = 0;
+
+        switch (op)
+        {
+        case opcode::bdd_or:
+            bdd1 = complement(bdd1);
+            bdd2 = complement(bdd2);
+            op = opcode::bdd_and;
+            result_complement = 1;
+            break;
+        case opcode::bdd_xor:
+            result_complement = (bdd1 ^ bdd2) & 1;
+            bdd1 = regular(bdd1);
+            bdd2 = regular(bdd2);
+            break;
+        }
+
+        order_operands(bdd1, bdd2);
+        return result_complement;
+    }
+
+    // every op is commutative, so (a, b) and (b, a) share a computed table entry
+    static void order_operands(node_handle& bdd1, node_handle& bdd2)
+    {
+        if (bdd1 > bdd2)
+        {
+            std::swap(bdd1, bdd2);
+        }
+    }
+
+    // the result of op if it follows from the operands without recursing, else invalid_handle.
+    // covers every pair of terminals, and a terminal, equal or complementary operand on either side.
+    node_handle terminal_case(node_handle bdd1, node_handle bdd2, uint32_t op) const
+    {
+        switch (op)
+        {
+        case opcode::bdd_and:
+            if (bdd1 == false_node || bdd2 == false_node || bdd1 == complement(bdd2))
+                return false_node;
+            if (bdd1 == true_node || bdd1 == bdd2)
+                return bdd2;
+            if (bdd2 == true_node)
+                return bdd1;
+            break;
+        case opcode::bdd_or:
+            if (bdd1 == true_node || bdd2 == true_node || bdd1 == complement(bdd2))
+                return true_node;
+            if (bdd1 == false_node || bdd1 == bdd2)
+                return bdd2;
+            if (bdd2 == false_node)
+                return bdd1;
+            break;
+        case opcode::bdd_xor:
+            if (bdd1 == bdd2)
+                return false_node;
+            if (bdd1 == complement(bdd2))
+                return true_node;
+            if (regular(bdd1) == true_node)
+                return bdd1 == true_node ? complement(bdd2) : bdd2;
+            if (regular(bdd2) == true_node)
+                return bdd2 == true_node ? complement(bdd1) : bdd1;
+            break;
+        }
+        return invalid_handle;
+    }
+
+#ifdef HAVE_APPLY_TASK
+    class make_node_task : public tbb::task
+    {
+        robdd* m_bdd;
+        node_handle m_bdd1;
+        node_handle m_bdd2;
+        uint32_t m_op;
+        node_handle* m_n;
+
+    public:
+        uint32_t level;
+        node_handle lo;
+        node_handle hi;
+
+        make_node_task(robdd* bdd, node_handle bdd1, node_handle bdd2, uint32_t op, node_handle* n)
+            : m_bdd(bdd)
+            , m_bdd1(bdd1)
+            , m_bdd2(bdd2)
+            , m_op(op)
+            , m_n(n)
+        { }
+
+        tbb::task* execute() override
+        {
+            *m_n = m_bdd->make_node(level, lo, hi);
+            m_bdd->computedtb.insert({ m_bdd1, m_bdd2 }, m_op, *m_n);
+            return NULL;
+        }
+    };
+
+    class apply_task : public tbb::task
+    {
+        robdd* m_bdd;
+        node_handle m_bdd1;
+        node_handle m_bdd2;
+        uint32_t m_op;
+        uint32_t m_level;
+        node_handle* m_n;
+
+    public:
+        apply_task(robdd* bdd, node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level, node_handle* n)
+            : m_bdd(bdd)
+            , m_bdd1(bdd1)
+            , m_bdd2(bdd2)
+            , m_op(op)
+            , m_level(level)
+            , m_n(n)
+        { }
+
+        tbb::task* execute() override
+        {
+            if (m_level >= m_bdd->max_level)
+            {
+                *m_n = m_bdd->apply_seq(m_bdd1, m_bdd2, m_op);
+                return NULL;
+            }
+
+            node_handle n = m_bdd->terminal_case(m_bdd1, m_bdd2, m_op);
+            if (n != invalid_handle)
+            {
+                *m_n = n;
+                return NULL;
+            }
+
+            order_operands(m_bdd1, m_bdd2);
+
+            node_handle found = m_bdd->computedtb.find({ m_bdd1, m_bdd2 }, m_op);
+            if (found != invalid_handle)
+            {
+                *m_n = found;
+                return NULL;
+            }
+
+            make_node_task& c = *new (allocate_continuation()) make_node_task(m_bdd, m_bdd1, m_bdd2, m_op, m_n);
+
+            apply_task* a;
+
+            if (m_bdd->get_level(m_bdd1) == m_bdd->get_level(m_bdd2))
+            {
+                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd->get_lo(m_bdd1), m_bdd->get_lo(m_bdd2), m_op, m_level + 1, &c.lo);
+                c.level = m_bdd->get_level(m_bdd1);
+
+                m_bdd1 = m_bdd->get_hi(m_bdd1);
+                m_bdd2 = m_bdd->get_hi(m_bdd2);
+                m_level = m_level + 1;
+                m_n = &c.hi;
+            }
+            else if (m_bdd->get_level(m_bdd1) < m_bdd->get_level(m_bdd2))
+            {
+                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd->get_lo(m_bdd1), m_bdd2, m_op, m_level + 1, &c.lo);
+                c.level = m_bdd->get_level(m_bdd1);
+
+                m_bdd1 = m_bdd->get_hi(m_bdd1);
+                m_level = m_level + 1;
+                m_n = &c.hi;
+            }
+            else
+            {
+                a = new (c.allocate_child()) apply_task(m_bdd, m_bdd1, m_bdd->get_lo(m_bdd2), m_op, m_level + 1, &c.lo);
+                c.level = m_bdd->get_level(m_bdd2);
+
+                m_bdd2 = m_bdd->get_hi(m_bdd2);
+                m_level = m_level + 1;
+                m_n = &c.hi;
+            }
+
+            recycle_as_child_of(c);
+            c.set_ref_count(2);
+            spawn(*a);
+            return this;
+        }
+    };
+
+    node_handle apply_seq(node_handle bdd1, node_handle bdd2, uint32_t op)
+    {
+        node_handle n = terminal_case(bdd1, bdd2, op);
+        if (n != invalid_handle)
+        {
+            return n;
+        }
+
+        order_operands(bdd1, bdd2);
+
+        node_handle found = computedtb.find({ bdd1, bdd2 }, op);
+        if (found != invalid_handle)
+        {
+            return found;
+        }
+
+        node_handle lo, hi;
+        if (get_level(bdd1) == get_level(bdd2))
+        {
+            lo = apply_seq(get_lo(bdd1), get_lo(bdd2), op);
+            hi = apply_seq(get_hi(bdd1), get_hi(bdd2), op);
+            n = make_node(get_level(bdd1), lo, hi);
+        }
+        else if (get_level(bdd1) < get_level(bdd2))
+        {
+            lo = apply_seq(get_lo(bdd1), bdd2, op);
+            hi = apply_seq(get_hi(bdd1), bdd2, op);
+            n = make_node(get_level(bdd1), lo, hi);
+        }
+        else
+        {
+            lo = apply_seq(bdd1, get_lo(bdd2), op);
+            hi = apply_seq(bdd1, get_hi(bdd2), op);
+            n = make_node(get_level(bdd2), lo, hi);
+        }
+
+        computedtb.insert({ bdd1, bdd2 }, op, n);
+
+        return n;
+    }
+#endif
+
+    node_handle apply(node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level)
+    {
+        node_handle result_complement = normalize(bdd1, bdd2, op);
+#ifdef HAVE_APPLY_TASK
+        if (apply_tasks)
+        {
+            node_handle n;
+            tbb::task::spawn_root_and_wait(*new(tbb::task::allocate_root()) apply_task(this, bdd1, bdd2, op, level, &n));
+            return n ^ result_complement;
+        }
+#endif
+        return apply_normalized(bdd1, bdd2, op, level) ^ result_complement;
+    }
+
+    node_handle apply_normalized(node_handle bdd1, node_handle bdd2, uint32_t op, uint32_t level)
+    {
+        node_handle n = terminal_case(bdd1, bdd2, op);
+        if (n != invalid_handle)
+        {
+            return n;
+        }
+
+        node_handle found = computedtb.find({ bdd1, bdd2 }, op);
+        if (found != invalid_handle)
+        {
+            return found;
+        }
+
+#ifndef SINGLETHREADED
+        if (level < max_level)
+        {
+            tbb::task_group g;
+            node_handle lo, hi;
+
+            if (get_level(bdd1) == get_level(bdd2))
+            {
+                g.run([&] { lo = apply(get_lo(bdd1), get_lo(bdd2), op, level + 1); });
+                g.run_and_wait([&] { hi = apply(get_hi(bdd1), get_hi(bdd2), op, level + 1); });
+                n = make_node(get_level(bdd1), lo, hi);
+            }
+            else if (get_level(bdd1) < get_level(bdd2))
+            {
+                g.run([&] { lo = apply(get_lo(bdd1), bdd2, op, level + 1); });
+                g.run_and_wait([&] { hi = apply(get_hi(bdd1), bdd2, op, level + 1); });
+                n = make_node(get_level(bdd1), lo, hi);
+            }
+            else
+            {
+                g.run([&] { lo = apply(bdd1, get_lo(bdd2), op, level + 1); });
+                g.run_and_wait([&] { hi = apply(bdd1, get_hi(bdd2), op, level + 1); });
+                n = make_node(get_level(bdd2), lo, hi);
+            }
+        }
+        else
+#endif
+        {
+            node_handle lo, hi;
+            if (get_level(bdd1) == get_level(bdd2))
+            {
+                lo = apply(get_lo(bdd1), get_lo(bdd2), op, level);
+                hi = apply(get_hi(bdd1), get_hi(bdd2), op, level);
+                n = make_node(get_level(bdd1), lo, hi);
+            }
+            else if (get_level(bdd1) < get_level(bdd2))
+            {
+                lo = apply(get_lo(bdd1), bdd2, op, level);
+                hi = apply(get_hi(bdd1), bdd2, op, level);
+                n = make_node(get_level(bdd1), lo, hi);
+            }
+            else
+            {
+                lo = apply(bdd1, get_lo(bdd2), op, level);
+                hi = apply(bdd1, get_hi(bdd2), op, level);
+                n = make_node(get_level(bdd2), lo, hi);
+            }
+        }
+
+        computedtb.insert({ bdd1, bdd2 }, op, n);
+
+        return n;
+    }
+
+    // if f then g else h
+    node_handle ite(node_handle f, node_handle g, node_handle h, uint32_t level)
+    {
+        if (f == true_node || g == h)
+            return g;
+        if (f == false_node)
+            return h;
+
+        // an operand equal to f (or its complement) is a constant wherever it gets chosen
+        if (g == f)
+            g = true_node;
+        else if (g == complement(f))
+            g = false_node;
+        if (h == f)
+            h = false_node;
+        else if (h == complement(f))
+            h = true_node;
+
+        // whatever apply can do by itself goes through the binary table
+        if (g == true_node)
+            return h == false_node ? f : apply(f, h, opcode::bdd_or, level);
+        if (g == false_node)
+            return h == true_node ? complement(f) : apply(complement(f), h, opcode::bdd_and, level);
+        if (h == false_node)
+            return apply(f, g, opcode::bdd_and, level);
+        if (h == true_node)
+            return apply(complement(f), g, opcode::bdd_or, level);
+        if (h == complement(g))
+            return complement(apply(f, g, opcode::bdd_xor, level));
+
+        // standard triple: a regular f (by swapping the branches) and a regular g (by complementing the result)
+        if (f & 1)
+        {
+            f = complement(f);
+            std::swap(g, h);
+        }
+        node_handle result_complement = g & 1;
+        g ^= result_complement;
+        h ^= result_complement;
+
+        node_handle found = ternarytb.find({ f, g, h }, opcode::bdd_ite);
+        if (found != invalid_handle)
+        {
+            return found ^ result_complement;
+        }
+
+        uint32_t top = std::min(get_level(f), std::min(get_level(g), get_level(h)));
+        auto lo_of = [&](node_handle x) { return get_level(x) == top ? get_lo(x) : x; };
+        auto hi_of = [&](node_handle x) { return get_level(x) == top ? get_hi(x) : x; };
+
+        node_handle lo, hi;
+#ifndef SINGLETHREADED
+        if (level < max_level)
+        {
+            tbb::task_group tg;
+            tg.run([&] { lo = ite(lo_of(f), lo_of(g), lo_of(h), level + 1); });
+            tg.run_and_wait([&] { hi = ite(hi_of(f), hi_of(g), hi_of(h), level + 1); });
+        }
+        else
+#endif
+        {
+            lo = ite(lo_of(f), lo_of(g), lo_of(h), level);
+            hi = ite(hi_of(f), hi_of(g), hi_of(h), level);
+        }
+
+        node_handle n = make_node(top, lo, hi);
+
+        ternarytb.insert({ f, g, h }, opcode::bdd_ite, n);
+
+        return n ^ result_complement;
+    }
+
+    // a cube is the conjunction of the variables to quantify. its variables are the ones on the path
+    // of hi edges from its root, so this steps past those that sit above the given level.
+    node_handle skip_cube_to(node_handle cube, uint32_t level) const
+    {
+        while (cube != true_node && get_level(cube) < level)
+        {
+            cube = get_hi(cube);
+        }
+        return cube;
+    }
+
+    // whether cube is a conjunction of variables, as exists, forall and and_exists take: every node has a
+    // false lo edge and goes on through its hi edge
+    bool is_positive_cube(node_handle cube) const
+    {
+        while (regular(cube) != true_node)
+        {
+            if (get_lo(cube) != false_node)
+                return false;
+            cube = get_hi(cube);
+        }
+        return cube == true_node;
+    }
+
+    // whether cube is a conjunction of literals, as cofactor takes: every node has exactly one child that
+    // isn't false, and goes on through it
+    bool is_literal_cube(node_handle cube) const
+    {
+        while (regular(cube) != true_node)
+        {
+            if (get_lo(cube) != false_node && get_hi(cube) != false_node)
+                return false;
+            cube = get_lo(cube) == false_node ? get_hi(cube) : get_lo(cube);
+        }
+        return cube == true_node;
+    }
+
+    // f with the variables of cube existentially quantified away
+    node_handle exists(node_handle f, node_handle cube, uint32_t level)
+    {
+        if (regular(f) == true_node)
+            return f;
+
+        cube = skip_cube_to(cube, get_level(f));
+        if (cube == true_node)
+            return f;
+
+        node_handle found = computedtb.find({ f, cube }, opcode::bdd_exists);
+        if (found != invalid_handle)
+        {
+            return found;
+        }
+
+        uint32_t top = get_level(f);
+        // a quantified variable ORs the cofactors together instead of branching on them
+        bool quantified = get_level(cube) == top;
+        node_handle sub_cube = quantified ? get_hi(cube) : cube;
+
+        node_handle lo, hi;
+#ifndef SINGLETHREADED
+        if (level < max_level)
+        {
+            tbb::task_group tg;
+            tg.run([&] { lo = exists(get_lo(f), sub_cube, level + 1); });
+            tg.run_and_wait([&] { hi = exists(get_hi(f), sub_cube, level + 1); });
+        }
+        else
+#endif
+        {
+            lo = exists(get_lo(f), sub_cube, level);
+            // nothing is more true than true
+            hi = quantified && lo == true_node ? true_node : exists(get_hi(f), sub_cube, level);
+        }
+
+        node_handle n = quantified ? apply(lo, hi, opcode::bdd_or, level) : make_node(top, lo, hi);
+
+        computedtb.insert({ f, cube }, opcode::bdd_exists, n);
+
+        return n;
+    }
+
+    // f with the variables of cube universally quantified away
+    node_handle forall(node_handle f, node_handle cube, uint32_t level)
+    {
+        return complement(exists(complement(f), cube, level));
+    }
+
+    // exists(f AND g, cube), without building f AND g
+    node_handle and_exists(node_handle f, node_handle g, node_handle cube, uint32_t level)
+    {
+        if (f == false_node || g == false_node || f == complement(g))
+            return false_node;
+        if (f == true_node || f == g)
+            return exists(g, cube, level);
+        if (g == true_node)
+            return exists(f, cube, level);
+
+        order_operands(f, g);
+
+        uint32_t top = std::min(get_level(f), get_level(g));
+        cube = skip_cube_to(cube, top);
+        if (cube == true_node)
+            return apply(f, g, opcode::bdd_and, level);
+
+        node_handle found = ternarytb.find({ f, g, cube }, opcode::bdd_and_exists);
+        if (found != invalid_handle)
+        {
+            return found;
+        }
+
+        bool quantified = get_level(cube) == top;
+        node_handle sub_cube = quantified ? get_hi(cube) : cube;
+
+        node_handle f_lo = get_level(f) == top ? get_lo(f) : f;
+        node_handle f_hi = get_level(f) == top ? get_hi(f) : f;
+        node_handle g_lo = get_level(g) == top ? get_lo(g) : g;
+        node_handle g_hi = get_level(g) == top ? get_hi(g) : g;
+
+        node_handle lo, hi;
+#ifndef SINGLETHREADED
+        if (level < max_level)
+        {
+            tbb::task_group tg;
+            tg.run([&] { lo = and_exists(f_lo, g_lo, sub_cube, level + 1); });
+            tg.run_and_wait([&] { hi = and_exists(f_hi, g_hi, sub_cube, level + 1); });
+        }
+        else
+#endif
+        {
+            lo = and_exists(f_lo, g_lo, sub_cube, level);
+            hi = quantified && lo == true_node ? true_node : and_exists(f_hi, g_hi, sub_cube, level);
+        }
+
+        node_handle n = quantified ? apply(lo, hi, opcode::bdd_or, level) : make_node(top, lo, hi);
+
+        ternarytb.insert({ f, g, cube }, opcode::bdd_and_exists, n);
+
+        return n;
+    }
+
+    // f with the variables of cube fixed to the values cube gives them. cube is a conjunction of
+    // literals, so every one of its nodes has a false edge and follows the other one.
+    node_handle cofactor(node_handle f, node_handle cube, uint32_t level)
+    {
+        if (regular(f) == true_node || cube == true_node)
+            return f;
+
+        // all three operations here commute with negating f, so only regular f are cached
+        node_handle result_complement = f & 1;
+        f ^= result_complement;
+
+        uint32_t top = get_level(f);
+        while (cube != true_node && get_level(cube) < top)
+        {
+            cube = get_lo(cube) == false_node ? get_hi(cube) : get_lo(cube);
+        }
+        if (cube == true_node)
+            return f ^ result_complement;
+
+        node_handle found = computedtb.find({ f, cube }, opcode::bdd_cofactor);
+        if (found != invalid_handle)
+        {
+            return found ^ result_complement;
+        }
+
+        node_handle n;
+        if (get_level(cube) == top)
+        {
+            // an assigned variable picks a branch instead of splitting
+            n = get_lo(cube) == false_node
+                ? cofactor(get_hi(f), get_hi(cube), level)
+                : cofactor(get_lo(f), get_lo(cube), level);
+        }
+        else
+        {
+            node_handle lo, hi;
+#ifndef SINGLETHREADED
+            if (level < max_level)
+            {
+                tbb::task_group tg;
+                tg.run([&] { lo = cofactor(get_lo(f), cube, level + 1); });
+                tg.run_and_wait([&] { hi = cofactor(get_hi(f), cube, level + 1); });
+            }
+            else
+#endif
+            {
+                lo = cofactor(get_lo(f), cube, level);
+                hi = cofactor(get_hi(f), cube, level);
+            }
+            n = make_node(top, lo, hi);
+        }
+
+        computedtb.insert({ f, cube }, opcode::bdd_cofactor, n);
+
+        return n ^ result_complement;
+    }
+
+    // the generalized cofactor of f by the care set c: agrees with f wherever c holds, and maps every
+    // point outside c to the value of f at a nearby point of c. constrain(f, c) AND c == f AND c.
+    node_handle constrain(node_handle f, node_handle c, uint32_t level)
+    {
+        return simplify(f, c, opcode::bdd_constrain, level);
+    }
+
+    // like constrain, but quantifies away the variables of c that f doesn't test, so the result
+    // never depends on a variable that f doesn't. usually smaller, though not always.
+    node_handle restrict(node_handle f, node_handle c, uint32_t level)
+    {
+        return simplify(f, c, opcode::bdd_restrict, level);
+    }
+
+    // constrain and restrict, which only differ in how they treat care set variables above f
+    node_handle simplify(node_handle f, node_handle c, uint32_t op, uint32_t level)
+    {
+        if (c == false_node)
+            return false_node;
+        if (c == true_node || regular(f) == true_node)
+            return f;
+        if (f == c)
+            return true_node;
+        if (f == complement(c))
+            return false_node;
+
+        node_handle result_complement = f & 1;
+        f ^= result_complement;
+
+        if (op == opcode::bdd_restrict && get_level(c) < get_level(f))
+        {
+            // f doesn't test c's top variable, so either value of it will do
+            return simplify(f, apply(get_lo(c), get_hi(c), opcode::bdd_or, level), op, level) ^ result_complement;
+        }
+
+        node_handle found = computedtb.find({ f, c }, op);
+        if (found != invalid_handle)
+        {
+            return found ^ result_complement;
+        }
+
+        uint32_t top = std::min(get_level(f), get_level(c));
+        node_handle f_lo = get_level(f) == top ? get_lo(f) : f;
+        node_handle f_hi = get_level(f) == top ? get_hi(f) : f;
+        node_handle c_lo = get_level(c) == top ? get_lo(c) : c;
+        node_handle c_hi = get_level(c) == top ? get_hi(c) : c;
+
+        node_handle n;
+        if (c_lo == false_node)
+        {
+            n = simplify(f_hi, c_hi, op, level);
+        }
+        else if (c_hi == false_node)
+        {
+            n = simplify(f_lo, c_lo, op, level);
+        }
+        else
+        {
+            node_handle lo, hi;
+#ifndef SINGLETHREADED
+            if (level < max_level)
+            {
+                tbb::task_group tg;
+                tg.run([&] { lo = simplify(f_lo, c_lo, op, level + 1); });
+                tg.run_and_wait([&] { hi = simplify(f_hi, c_hi, op, level + 1); });
+            }
+            else
+#endif
+            {
+                lo = simplify(f_lo, c_lo, op, level);
+                hi = simplify(f_hi, c_hi, op, level);
+            }
+            n = make_node(top, lo, hi);
+        }
+
+        computedtb.insert({ f, c }, op, n);
+
+        return n ^ result_complement;
+    }
+
+    // f with every vars[i] replaced by the function gs[i] at once
+    node_handle compose(node_handle f, int num_vars, const uint32_t* vars, const node_handle* gs, uint32_t level)
+    {
+        substitution s;
+        s.id = next_substitution_id++;
+        s.by_level.assign(level2var.size(), invalid_handle);
+        s.bottom = 0;
+        for (int i = 0; i < num_vars; i++)
+        {
+            s.by_level[var2level[vars[i]]] = gs[i];
+            s.bottom = std::max(s.bottom, var2level[vars[i]]);
+        }
+
+        return num_vars == 0 ? f : compose(f, s, level);
+    }
+
+    // f with every from_vars[i] replaced by the variable to_vars[i] at once
+    node_handle rename(node_handle f, int num_vars, const uint32_t* from_vars, const uint32_t* to_vars, uint32_t level)
+    {
+        std::vector<node_handle> gs(num_vars);
+        for (int i = 0; i < num_vars; i++)
+        {
+            gs[i] = make_var(to_vars[i]);
+        }
+        return compose(f, num_vars, from_vars, gs.data(), level);
+    }
+
+    node_handle compose(node_handle f, const substitution& s, uint32_t level)
+    {
+        if (regular(f) == true_node || get_level(f) > s.bottom)
+            return f;
+
+        node_handle result_complement = f & 1;
+        f ^= result_complement;
+
+        node_handle found = computedtb.find({ f, s.id }, opcode::bdd_compose);
+        if (found != invalid_handle)
+        {
+            return found ^ result_complement;
+        }
+
+        node_handle lo, hi;
+#ifndef SINGLETHREADED
+        if (level < max_level)
+        {
+            tbb::task_group tg;
+            tg.run([&] { lo = compose(get_lo(f), s, level + 1); });
+            tg.run_and_wait([&] { hi = compose(get_hi(f), s, level + 1); });
+        }
+        else
+#endif
+        {
+            lo = compose(get_lo(f), s, level);
+            hi = compose(get_hi(f), s, level);
+        }
+
+        uint32_t top = get_level(f);
+        node_handle g = s.by_level[top];
+        if (g == invalid_handle)
+        {
+            g = make_node(top, false_node, true_node);
+        }
+
+        node_handle n;
+        if (regular(g) != true_node && get_lo(g) == false_node && get_hi(g) == true_node &&
+            get_level(g) < std::min(get_level(lo), get_level(hi)))
+        {
+            // a variable that still sits above both cofactors, as when renaming in order, is a single node
+            n = make_node(get_level(g), lo, hi);
+        }
+        else
+        {
+            n = ite(g, hi, lo, level);
+        }
+
+        computedtb.insert({ f, s.id }, opcode::bdd_compose, n);
+
+        return n ^ result_complement;
+    }
+
+    // the regular nodes reachable from some roots, grouped by level, for passes that compute a value per node
+    struct subgraph
+    {
+        // the terminal is alone at the last level
+        std::vector<std::vector<node_handle>> by_level;
+        // where each node's value goes, by node index. only meaningful for the nodes in by_level.
+        std::vector<uint32_t> position;
+        uint32_t num_nodes;
+    };
+
+    subgraph get_subgraph(int num_roots, const node_handle* roots)
+    {
+        std::unique_ptr<std::atomic<uint8_t>[]> marks = mark_live(num_roots, roots);
+
+        subgraph g;
+        g.by_level.resize(level2var.size());
+        g.position.resize(uniquetb.get_pool_size());
+        g.num_nodes = 0;
+
+        for (uint32_t i = 0; i < uniquetb.get_pool_size(); i++)
+        {
+            if (marks[i].load(std::memory_order_relaxed))
+            {
+                node_handle h = i << 1;
+                g.by_level[get_level(h)].push_back(h);
+                g.position[i] = g.num_nodes++;
+            }
+        }
+
+        return g;
+    }
+
+    // computes f(h, values) for every node h of g into values[g.position[node_index(h)]], a level at a
+    // time from the bottom up and in parallel within a level, so f can read the values of h's children
+    template<class T, class F>
+    std::vector<T> bottom_up(const subgraph& g, const T& terminal_value, F f)
+    {
+        std::vector<T> values(g.num_nodes);
+        values[g.position[node_index(true_node)]] = terminal_value;
+
+        for (uint32_t level = (uint32_t)g.by_level.size() - 1; level-- > 0;)
+        {
+            const std::vector<node_handle>& nodes = g.by_level[level];
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, nodes.size()), [&](const tbb::blocked_range<size_t>& range) {
+                for (size_t j = range.begin(); j != range.end(); j++)
+                {
+                    values[g.position[node_index(nodes[j])]] = f(nodes[j], (const std::vector<T>&)values);
+                }
+            });
+        }
+
+        return values;
+    }
+
+    // solutions of the edge h over the levels [level, num_vars), given the counts of regular nodes
+    big_uint edge_count(node_handle h, uint32_t level, const subgraph& g, const std::vector<big_uint>& counts) const
+    {
+        uint32_t num_vars = (uint32_t)level2var.size() - 1;
+        big_uint count = counts[g.position[node_index(h)]];
+        if (is_complemented(h))
+        {
+            big_uint all = big_uint::power_of_two(num_vars - get_level(h));
+            all -= count;
+            count = all;
+        }
+        return count << (get_level(h) - level);
+    }
+
+    // the solutions of every regular node of g, over the levels at and below it
+    std::vector<big_uint> count_nodes(const subgraph& g)
+    {
+        return bottom_up(g, big_uint(1), [&](node_handle h, const std::vector<big_uint>& counts) {
+            uint32_t level = get_level(h);
+            big_uint count = edge_count(get_lo(h), level + 1, g, counts);
+            count += edge_count(get_hi(h), level + 1, g, counts);
+            return count;
+        });
+    }
+
+    // the number of solutions of every root, over all variables
+    std::vector<big_uint> count_solutions(int num_roots, const node_handle* roots)
+    {
+        subgraph g = get_subgraph(num_roots, roots);
+        std::vector<big_uint> counts = count_nodes(g);
+
+        std::vector<big_uint> root_counts(num_roots);
+        for (int i = 0; i < num_roots; i++)
+        {
+            if (roots[i] != invalid_handle)
+            {
+                root_counts[i] = edge_count(roots[i], 0, g, counts);
+            }
+        }
+        return root_counts;
+    }
+
+    // the total weight of the assignments of all variables that satisfy each root, where an assignment
+    // weighs the product of false_weights[var] or true_weights[var] over its variables
+    std::vector<double> weighted_count(int num_roots, const node_handle* roots, const double* false_weights, const double* true_weights)
+    {
+        uint32_t num_vars = (uint32_t)level2var.size() - 1;
+
+        // what the levels an edge skips over contribute, since they're free, as a ratio of products over the
+        // levels from each one down. a product keeps its exponent apart, so long ones don't overflow, and
+        // leaves out the levels that weigh 0, which are counted instead so skipping one gives exactly 0.
+        std::vector<double> suffix_mantissa(num_vars + 1, 0.5);
+        std::vector<int> suffix_exponent(num_vars + 1, 1);
+        std::vector<uint32_t> suffix_zeros(num_vars + 1, 0);
+        for (uint32_t level = num_vars; level-- > 0;)
+        {
+            double level_weight = false_weights[level2var[level]] + true_weights[level2var[level]];
+            int exponent;
+            suffix_mantissa[level] = std::frexp(suffix_mantissa[level + 1] * (level_weight == 0.0 ? 1.0 : level_weight), &exponent);
+            suffix_exponent[level] = suffix_exponent[level + 1] + exponent;
+            suffix_zeros[level] = suffix_zeros[level + 1] + (level_weight == 0.0 ? 1 : 0);
+        }
+        auto skipped_weight = [&](uint32_t from_level, uint32_t to_level) {
+            if (suffix_zeros[from_level] != suffix_zeros[to_level])
+            {
+                return 0.0;
+            }
+            return std::ldexp(suffix_mantissa[from_level] / suffix_mantissa[to_level], suffix_exponent[from_level] - suffix_exponent[to_level]);
+        };
+
+        // the complement's weight is kept alongside instead of subtracting from the total, which would lose precision
+        struct node_weights
+        {
+            double regular;
+            double complemented;
+        };
+
+        subgraph g = get_subgraph(num_roots, roots);
+
+        auto edge_weight = [&](node_handle h, uint32_t level, const std::vector<node_weights>& weights) {
+            const node_weights& w = weights[g.position[node_index(h)]];
+            return (is_complemented(h) ? w.complemented : w.regular) * skipped_weight(level, get_level(h));
+        };
+
+        std::vector<node_weights> weights = bottom_up(g, node_weights{ 1.0, 0.0 }, [&](node_handle h, const std::vector<node_weights>& weights) {
+            uint32_t level = get_level(h);
+            uint32_t var = level2var[level];
+            node_handle lo = get_lo(h);
+            node_handle hi = get_hi(h);
+
+            node_weights w;
+            w.regular = false_weights[var] * edge_weight(lo, level + 1, weights) + true_weights[var] * edge_weight(hi, level + 1, weights);
+            w.complemented = false_weights[var] * edge_weight(complement(lo), level + 1, weights) + true_weights[var] * edge_weight(complement(hi), level + 1, weights);
+            return w;
+        });
+
+        std::vector<double> root_weights(num_roots, 0.0);
+        for (int i = 0; i < num_roots; i++)
+        {
+            if (roots[i] != invalid_handle)
+            {
+                root_weights[i] = edge_weight(roots[i], 0, weights);
+            }
+        }
+        return root_weights;
+    }
+
+    // draws num_samples solutions of root over all variables, independently and uniformly at random.
+    // each is packed into (num_vars + 7) / 8 bytes, with var v in bit v % 8 of byte v / 8, and they
+    // are handed to write(data, size) in order, in chunks. the same seed gives the same samples
+    // however many threads draw them. returns false, without drawing any, if root has no solutions.
+    template<class F>
+    bool sample(node_handle root, uint64_t num_samples, uint64_t seed, F write)
+    {
+        if (root == false_node)
+        {
+            return false;
+        }
+
+        uint32_t num_vars = (uint32_t)level2var.size() - 1;
+
+        subgraph g = get_subgraph(1, &root);
+        std::vector<big_uint> counts = count_nodes(g);
+
+        // the chance that a random solution of a node takes its hi edge, for the node and its complement
+        struct hi_odds
+        {
+            double regular;
+            double complemented;
+        };
+
+        auto fraction = [](const big_uint& part, const big_uint& rest) {
+            big_uint whole = part;
+            whole += rest;
+            uint32_t bits = whole.bit_length();
+            uint32_t shift = bits > 64 ? bits - 64 : 0;
+            return whole.bit_length() == 0 ? 0.0 : part.to_double(shift) / whole.to_double(shift);
+        };
+
+        std::vector<hi_odds> odds(g.num_nodes);
+        for (uint32_t level = 0; level < num_vars; level++)
+        {
+            const std::vector<node_handle>& nodes = g.by_level[level];
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, nodes.size()), [&](const tbb::blocked_range<size_t>& range) {
+                for (size_t j = range.begin(); j != range.end(); j++)
+                {
+                    node_handle h = nodes[j];
+                    hi_odds& o = odds[g.position[node_index(h)]];
+                    o.regular = fraction(
+                        edge_count(get_hi(h), level + 1, g, counts),
+                        edge_count(get_lo(h), level + 1, g, counts));
+                    o.complemented = fraction(
+                        edge_count(complement(get_hi(h)), level + 1, g, counts),
+                        edge_count(complement(get_lo(h)), level + 1, g, counts));
+                }
+            });
+        }
+
+        // every block of samples has its own random stream, seeded by its index
+        static const uint64_t samples_per_block = 0x1000;
+        static const uint64_t blocks_per_chunk = 0x40;
+
+        size_t sample_bytes = (num_vars + 7) / 8;
+        std::vector<uint8_t> chunk(samples_per_block * blocks_per_chunk * sample_bytes);
+
+        for (uint64_t first_block = 0; first_block * samples_per_block < num_samples; first_block += blocks_per_chunk)
+        {
+            uint64_t chunk_samples = std::min(num_samples - first_block * samples_per_block, samples_per_block * blocks_per_chunk);
+            uint64_t num_blocks = (chunk_samples + samples_per_block - 1) / samples_per_block;
+
+            tbb::parallel_for(uint64_t(0), num_blocks, [&](uint64_t b) {
+                std::seed_seq seq{ uint32_t(seed), uint32_t(seed >> 32), uint32_t(first_block + b), uint32_t((first_block + b) >> 32) };
+                std::mt19937_64 rng(seq);
+
+                uint64_t end = std::min((b + 1) * samples_per_block, chunk_samples);
+                for (uint64_t i = b * samples_per_block; i < end; i++)
+                {
+                    uint8_t* out = &chunk[i * sample_bytes];
+                    std::fill(out, out + sample_bytes, 0);
+
+                    uint64_t bits = 0;
+                    uint32_t num_bits = 0;
+
+                    node_handle h = root;
+                    for (uint32_t level = 0; level < num_vars; level++)
+                    {
+                        bool value;
+                        if (get_level(h) != level)
+                        {
+                            // nothing on the path tests this variable, so it's a coin flip
+                            if (num_bits == 0)
+                            {
+                                bits = rng();
+                                num_bits = 64;
+                            }
+                            value = bits & 1;
+                            bits >>= 1;
+                            num_bits--;
+                        }
+                        else
+                        {
+                            const hi_odds& o = odds[g.position[node_index(h)]];
+                            double u = double(rng() >> 11) * (1.0 / 9007199254740992.0);
+                            value = u < (is_complemented(h) ? o.complemented : o.regular);
+                            h = value ? get_hi(h) : get_lo(h);
+                        }
+
+                        if (value)
+                        {
+                            uint32_t var = level2var[level];
+                            out[var / 8] |= uint8_t(1 << (var % 8));
+                        }
+                    }
+                }
+            });
+
+            write(chunk.data(), size_t(chunk_samples * sample_bytes));
+        }
+
+        return true;
+    }
+
+    struct solution_format
+    {
+        enum {
+            // a line per cube, with a 0, 1 or - per variable
+            text_cubes,
+            // a line per assignment, with a 0 or 1 per variable
+            text_assignments,
+            // a cube is the bits that are set, then the bits that are cared about, each packed like a sample
+            binary_cubes,
+            // an assignment is packed like a sample
+            binary_assignments,
+        };
+    };
+
+private:
+    // the state of one enumerate call, shared by the tasks it splits into
+    class enumerator
+    {
+        robdd* r;
+        int format;
+        const std::function<void(const char*, size_t)>& write;
+        std::mutex write_mutex;
+        uint32_t num_vars;
+        size_t packed_bytes;
+
+        static const size_t flush_size = 1 << 20;
+
+    public:
+        std::atomic<uint64_t> num_written;
+
+        // what the path so far assigned to every variable, by var: 0, 1, or 2 for don't care
+        struct path
+        {
+            std::vector<uint8_t> values;
+            std::string buffer;
+            uint64_t num_written = 0;
+        };
+
+        enumerator(robdd* r, int format, const std::function<void(const char*, size_t)>& write)
+            : r(r)
+            , format(format)
+            , write(write)
+            , num_vars((uint32_t)r->level2var.size() - 1)
+            , packed_bytes((num_vars + 7) / 8)
+            , num_written(0)
+        { }
+
+        void flush(path& p)
+        {
+            if (!p.buffer.empty())
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                write(p.buffer.data(), p.buffer.size());
+            }
+            p.buffer.clear();
+            num_written += p.num_written;
+            p.num_written = 0;
+        }
+
+        void emit(path& p)
+        {
+            switch (format)
+            {
+            case solution_format::text_cubes:
+            case solution_format::text_assignments:
+                for (uint8_t v : p.values)
+                {
+                    p.buffer += "01-"[v];
+                }
+                p.buffer += '\n';
+                break;
+            case solution_format::binary_cubes:
+            case solution_format::binary_assignments:
+            {
+                size_t start = p.buffer.size();
+                p.buffer.resize(start + packed_bytes * (format == solution_format::binary_cubes ? 2 : 1), 0);
+                char* values = &p.buffer[start];
+                char* cares = values + packed_bytes;
+                for (uint32_t var = 0; var < num_vars; var++)
+                {
+                    if (p.values[var] == 1)
+                        values[var / 8] |= char(1 << (var % 8));
+                    if (format == solution_format::binary_cubes && p.values[var] != 2)
+                        cares[var / 8] |= char(1 << (var % 8));
+                }
+                break;
+            }
+            }
+
+            p.num_written++;
+            if (p.buffer.size() >= flush_size)
+            {
+                flush(p);
+            }
+        }
+
+        void visit(node_handle h, uint32_t level, path& p, uint32_t depth)
+        {
+            if (h == r->false_node)
+            {
+                return;
+            }
+
+            bool cubes = format == solution_format::text_cubes || format == solution_format::binary_cubes;
+
+            if (level == num_vars || (cubes && h == r->true_node))
+            {
+                for (; level < num_vars; level++)
+                {
+                    p.values[r->level2var[level]] = 2;
+                }
+                emit(p);
+                return;
+            }
+
+            uint32_t var = r->level2var[level];
+
+            if (cubes && r->get_level(h) != level)
+            {
+                p.values[var] = 2;
+                visit(h, level + 1, p, depth);
+                return;
+            }
+
+            node_handle lo = r->get_level(h) == level ? r->get_lo(h) : h;
+            node_handle hi = r->get_level(h) == level ? r->get_hi(h) : h;
+
+#ifndef SINGLETHREADED
+            if (depth < r->max_level)
+            {
+                // the hi side gets a path of its own, and flushes it when it's done
+                path hi_path;
+                hi_path.values = p.values;
+                hi_path.values[var] = 1;
+
+                tbb::task_group tg;
+                tg.run([&] { visit(hi, level + 1, hi_path, depth + 1); flush(hi_path); });
+                p.values[var] = 0;
+                tg.run_and_wait([&] { visit(lo, level + 1, p, depth + 1); });
+                return;
+            }
+#endif
+
+            p.values[var] = 0;
+            visit(lo, level + 1, p, depth);
+            p.values[var] = 1;
+            visit(hi, level + 1, p, depth);
+        }
+    };
+
+public:
+    // writes every cube on a path from root to true, or every assignment that satisfies root, in one of
+    // the solution_formats. subtrees near the root go to separate tasks, which each fill a buffer of their
+    // own and hand it to write(data, size) once it's full, so the solutions are written in no particular
+    // order. write is never called concurrently. returns how many cubes or assignments were written.
+    uint64_t enumerate(node_handle root, int format, const std::function<void(const char*, size_t)>& write)
+    {
+        enumerator e(this, format, write);
+
+        enumerator::path p;
+        p.values.assign(level2var.size() - 1, 2);
+        e.visit(root, 0, p, 0);
+        e.flush(p);
+
+        return e.num_written;
+    }
+};
+
+// bdd forest files hold a set of roots and the names of the variables, so they can be used again without the script.
+// after the terminal at 0, nodes are numbered from the bottom level up, so every child comes before its parent.
+// an edge is a node's number shifted left once with the complement in the low bit. a node stores its lo and its
+// hi edge as varints, with the child's number taken off its own, which keeps most of them to a byte or two.
+// after the header come the number of nodes at every level from the top down, the edges of the roots, where
+// every block of forest_block_nodes nodes starts so the blocks can be read in parallel, the names of the
+// variables from the top level down and then of the roots, each a varint length and its bytes, and the nodes.
+static const char forest_magic[8] = { 'r', 'o', 'b', 'd', 'd', 'f', 's', '1' };
+static const uint64_t forest_block_nodes = 0x10000;
+
+struct forest_header
+{
+    char magic[8];
+    uint32_t num_vars;
+    uint32_t num_roots;
+    // not counting the terminal
+    uint64_t num_nodes;
+    uint64_t names_size;
+    uint64_t nodes_size;
+};
+
+struct bdd_forest
+{
+    std::vector<std::string> var_names;
+    std::vector<std::string> root_names;
+    // the number of the first node at each level and how many there are, from the top level down
+    std::vector<uint64_t> level_first;
+    std::vector<uint64_t> level_sizes;
+    std::vector<uint64_t> root_edges;
+    // the lo and hi edges of every node, by number
+    std::vector<uint64_t> edges;
+    // the input that stands for each level's variable in the script that loaded the file
+    std::vector<int> var_ast_ids;
+    // where it was read from, which is how traces refer to it
+    std::string path;
+};
+
+void put_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+// false if the varint runs past end
+bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; p != end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a whole file in memory for reading. it's mapped where there's mmap, and read in otherwise.
+class mapped_file
+{
+    const uint8_t* bytes = nullptr;
+    size_t num_bytes = 0;
+#ifdef _WIN32
+    std::vector<uint8_t> contents;
+#endif
+
+public:
+    explicit mapped_file(const char* fn)
+    {
+#ifdef _WIN32
+        FILE* f = fopen(fn, "rb");
+        if (!f)
+            return;
+
+        _fseeki64(f, 0, SEEK_END);
+        contents.resize((size_t)_ftelli64(f));
+        _fseeki64(f, 0, SEEK_SET);
+        if (fread(contents.data(), 1, contents.size(), f) == contents.size())
+        {
+            bytes = contents.data();
+            num_bytes = contents.size();
+        }
+        fclose(f);
+#else
+        int fd = open(fn, O_RDONLY);
+        if (fd == -1)
+            return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                bytes = (const uint8_t*)mapped;
+                num_bytes = (size_t)st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~mapped_file()
+    {
+#ifndef _WIN32
+        if (bytes)
+            munmap((void*)bytes, num_bytes);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const uint8_t* data() const
+    {
+        return bytes;
+    }
+
+    size_t size() const
+    {
+        return num_bytes;
+    }
+};
+
+// writes the roots and everything under them. var_names maps variable ids to names.
+bool save_forest(
+    robdd* r,
+    int num_roots, const robdd::node_handle* roots, const std::string* root_names,
+    const std::map<int, std::string>& var_names,
+    const char* fn)
+{
+    robdd::subgraph g = r->get_subgraph(num_roots, roots);
+    uint32_t num_vars = (uint32_t)g.by_level.size() - 1;
+
+    std::vector<uint64_t> number(g.num_nodes);
+    number[g.position[robdd::node_index(r->get_true())]] = 0;
+    uint64_t num_nodes = 0;
+    for (uint32_t level = num_vars; level-- > 0;)
+    {
+        for (robdd::node_handle h : g.by_level[level])
+        {
+            number[g.position[robdd::node_index(h)]] = ++num_nodes;
+        }
+    }
+
+    auto edge = [&](robdd::node_handle h) {
+        return number[g.position[robdd::node_index(h)]] << 1 | (robdd::is_complemented(h) ? 1 : 0);
+    };
+
+    std::vector<uint64_t> level_sizes(num_vars);
+    std::vector<uint64_t> block_offsets;
+    std::string nodes;
+    for (uint32_t level = num_vars; level-- > 0;)
+    {
+        level_sizes[level] = g.by_level[level].size();
+        for (robdd::node_handle h : g.by_level[level])
+        {
+            uint64_t n = number[g.position[robdd::node_index(h)]];
+            if ((n - 1) % forest_block_nodes == 0)
+            {
+                block_offsets.push_back(nodes.size());
+            }
+
+            uint64_t lo = edge(r->get_lo(h));
+            uint64_t hi = edge(r->get_hi(h));
+            put_varint(nodes, (n - (lo >> 1)) << 1 | (lo & 1));
+            put_varint(nodes, (n - (hi >> 1)) << 1 | (hi & 1));
+        }
+    }
+
+    std::vector<uint64_t> root_edges(num_roots);
+    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    {
+        root_edges[root_idx] = edge(roots[root_idx]);
+    }
+
+    std::string names;
+    for (uint32_t level = 0; level < num_vars; level++)
+    {
+        const std::string& name = var_names.at(r->get_level_var(level));
+        put_varint(names, name.size());
+        names += name;
+    }
+    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    {
+        put_varint(names, root_names[root_idx].size());
+        names += root_names[root_idx];
+    }
+
+    forest_header header;
+    memcpy(header.magic, forest_magic, sizeof(header.magic));
+    header.num_vars = num_vars;
+    header.num_roots = (uint32_t)num_roots;
+    header.num_nodes = num_nodes;
+    header.names_size = names.size();
+    header.nodes_size = nodes.size();
+
+    FILE* f = fopen(fn, "wb");
+    if (!f)
+        return false;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(level_sizes.data(), sizeof(uint64_t), level_sizes.size(), f);
+    fwrite(root_edges.data(), sizeof(uint64_t), root_edges.size(), f);
+    fwrite(block_offsets.data(), sizeof(uint64_t), block_offsets.size(), f);
+    fwrite(names.data(), 1, names.size(), f);
+    fwrite(nodes.data(), 1, nodes.size(), f);
+
+    bool ok = ferror(f) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+// false if the file can't be read or isn't a well formed forest
+bool load_forest(const char* fn, bdd_forest& forest)
+{
+    mapped_file file(fn);
+    const uint8_t* p = file.data();
+    const uint8_t* end = p + file.size();
+
+    forest_header header;
+    if (file.size() < sizeof(header))
+        return false;
+    memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+
+    if (memcmp(header.magic, forest_magic, sizeof(header.magic)) != 0)
+        return false;
+
+    uint64_t num_nodes = header.num_nodes;
+    uint64_t num_blocks = (num_nodes + forest_block_nodes - 1) / forest_block_nodes;
+    uint64_t num_words = (uint64_t)header.num_vars + header.num_roots + num_blocks;
+    if ((uint64_t)(end - p) / sizeof(uint64_t) < num_words)
+        return false;
+
+    std::vector<uint64_t> words(num_words);
+    memcpy(words.data(), p, num_words * sizeof(uint64_t));
+    p += num_words * sizeof(uint64_t);
+
+    if ((uint64_t)(end - p) < header.names_size || (uint64_t)(end - p) - header.names_size < header.nodes_size)
+        return false;
+
+    forest.level_sizes.assign(words.begin(), words.begin() + header.num_vars);
+    forest.level_first.resize(header.num_vars);
+    uint64_t next = 1;
+    for (uint32_t level = header.num_vars; level-- > 0;)
+    {
+        if (forest.level_sizes[level] > num_nodes + 1 - next)
+            return false;
+        forest.level_first[level] = next;
+        next += forest.level_sizes[level];
+    }
+    if (next != num_nodes + 1)
+        return false;
+
+    forest.root_edges.assign(words.begin() + header.num_vars, words.begin() + header.num_vars + header.num_roots);
+    for (uint64_t e : forest.root_edges)
+    {
+        if ((e >> 1) > num_nodes)
+            return false;
+    }
+    const uint64_t* block_offsets = words.data() + header.num_vars + header.num_roots;
+
+    const uint8_t* names_end = p + header.names_size;
+    for (uint64_t i = 0; i < (uint64_t)header.num_vars + header.num_roots; i++)
+    {
+        uint64_t length;
+        if (!get_varint(p, names_end, length) || length > (uint64_t)(names_end - p))
+            return false;
+        (i < header.num_vars ? forest.var_names : forest.root_names).emplace_back((const char*)p, (size_t)length);
+        p += length;
+    }
+
+    const uint8_t* nodes = names_end;
+    const uint8_t* nodes_end = nodes + header.nodes_size;
+    forest.edges.assign(2 * (num_nodes + 1), 0);
+
+    std::atomic<bool> ok(true);
+    tbb::parallel_for(tbb::blocked_range<uint64_t>(0, num_blocks), [&](const tbb::blocked_range<uint64_t>& range) {
+        for (uint64_t block = range.begin(); block != range.end(); block++)
+        {
+            if (block_offsets[block] > header.nodes_size)
+            {
+                ok = false;
+                return;
+            }
+            const uint8_t* q = nodes + block_offsets[block];
+
+            uint64_t first = 1 + block * forest_block_nodes;
+            uint64_t last = std::min(first + forest_block_nodes, num_nodes + 1);
+
+            // children have to be at a lower level than their parent, so below the first node of its level
+            uint32_t level = header.num_vars - 1;
+            while (forest.level_first[level] + forest.level_sizes[level] <= first)
+                level--;
+
+            for (uint64_t n = first; n < last; n++)
+            {
+                while (n == forest.level_first[level] + forest.level_sizes[level])
+                    level--;
+
+                for (int child = 0; child < 2; child++)
+                {
+                    uint64_t delta;
+                    if (!get_varint(q, nodes_end, delta) || (delta >> 1) < n + 1 - forest.level_first[level] || (delta >> 1) > n)
+                    {
+                        ok = false;
+                        return;
+                    }
+                    forest.edges[2 * n + child] = (n - (delta >> 1)) << 1 | (delta & 1);
+                }
+            }
+        }
+    });
+
+    return ok;
+}
+
+// builds some roots of a loaded forest in r, in one pass so the nodes they share are only made once.
+// var_bdds holds the variable of each of the forest's levels. nodes are made directly when r keeps those
+// variables in the same order, and otherwise each one is an ite of its variable.
+void import_forest_roots(
+    robdd* r, const bdd_forest& forest,
+    int num_roots, const int* root_idxs, const robdd::node_handle* var_bdds,
+    robdd::node_handle* results)
+{
+    uint32_t num_vars = (uint32_t)forest.level_sizes.size();
+    uint64_t num_nodes = forest.edges.size() / 2;
+
+    // the nodes under the roots, walking down from the top as every child comes before its parent
+    std::vector<uint8_t> in_cone(num_nodes);
+    for (int i = 0; i < num_roots; i++)
+    {
+        in_cone[forest.root_edges[root_idxs[i]] >> 1] = 1;
+    }
+    for (uint64_t n = num_nodes; n-- > 1;)
+    {
+        if (in_cone[n])
+        {
+            in_cone[forest.edges[2 * n] >> 1] = 1;
+            in_cone[forest.edges[2 * n + 1] >> 1] = 1;
+        }
+    }
+
+    std::vector<uint32_t> levels(num_vars);
+    bool same_order = true;
+    for (uint32_t level = 0; level < num_vars; level++)
+    {
+        levels[level] = r->get_level(var_bdds[level]);
+        same_order = same_order && (level == 0 || levels[level] > levels[level - 1]);
+    }
+
+    std::vector<robdd::node_handle> imported(num_nodes);
+    imported[0] = r->get_true();
+    auto edge = [&](uint64_t e) {
+        return (e & 1) ? r->negate(imported[e >> 1]) : imported[e >> 1];
+    };
+
+    auto import_nodes = [&](uint32_t level, uint64_t begin, uint64_t end) {
+        for (uint64_t n = begin; n != end; n++)
+        {
+            if (!in_cone[n])
+                continue;
+
+            robdd::node_handle lo = edge(forest.edges[2 * n]);
+            robdd::node_handle hi = edge(forest.edges[2 * n + 1]);
+            imported[n] = same_order ? r->make_node(levels[level], lo, hi) : r->ite(var_bdds[level], hi, lo, 0);
+        }
+    };
+
+    for (uint32_t level = num_vars; level-- > 0;)
+    {
+        uint64_t first = forest.level_first[level];
+        uint64_t last = first + forest.level_sizes[level];
+#ifndef SINGLETHREADED
+        tbb::parallel_for(tbb::blocked_range<uint64_t>(first, last), [&](const tbb::blocked_range<uint64_t>& range) {
+            import_nodes(level, range.begin(), range.end());
+        });
+#else
+        import_nodes(level, first, last);
+#endif
+    }
+
+    for (int i = 0; i < num_roots; i++)
+    {
+        results[i] = edge(forest.root_edges[root_idxs[i]]);
+    }
+}
+
+struct bdd_instr
+{
+    enum {
+        opcode_newinput,
+        opcode_and,
+        opcode_or,
+        opcode_xor,
+        opcode_not,
+        opcode_ite,
+        opcode_exists,
+        opcode_forall,
+        opcode_and_exists,
+        opcode_restrict,
+        opcode_constrain,
+        opcode_cofactor,
+        opcode_compose,
+        opcode_rename,
+        opcode_load
+    };
+
+    int opcode;
+
+    union
+    {
+        struct {
+            int operand_newinput_ast_id;
+            int operand_newinput_var_id;
+            const std::string* operand_newinput_name;
+        };
+
+        struct {
+            int operand_and_dst_id;
+            int operand_and_src1_id;
+            int operand_and_src2_id;
+        };
+
+        struct {
+            int operand_or_dst_id;
+            int operand_or_src1_id;
+            int operand_or_src2_id;
+        };
+
+        struct {
+            int operand_xor_dst_id;
+            int operand_xor_src1_id;
+            int operand_xor_src2_id;
+        };
+
+        struct {
+            int operand_not_dst_id;
+            int operand_not_src_id;
+        };
+
+        struct {
+            int operand_ite_dst_id;
+            int operand_ite_if_id;
+            int operand_ite_then_id;
+            int operand_ite_else_id;
+        };
+
+        struct {
+            int operand_exists_dst_id;
+            int operand_exists_src_id;
+            int operand_exists_cube_id;
+        };
+
+        struct {
+            int operand_forall_dst_id;
+            int operand_forall_src_id;
+            int operand_forall_cube_id;
+        };
+
+        struct {
+            int operand_and_exists_dst_id;
+            int operand_and_exists_src1_id;
+            int operand_and_exists_src2_id;
+            int operand_and_exists_cube_id;
+        };
+
+        struct {
+            int operand_restrict_dst_id;
+            int operand_restrict_src_id;
+            int operand_restrict_care_id;
+        };
+
+        struct {
+            int operand_constrain_dst_id;
+            int operand_constrain_src_id;
+            int operand_constrain_care_id;
+        };
+
+        struct {
+            int operand_cofactor_dst_id;
+            int operand_cofactor_src_id;
+            int operand_cofactor_cube_id;
+        };
+
+        // pairs are the ast ids of an input and of what replaces it, one after the other
+        struct {
+            int operand_compose_dst_id;
+            int operand_compose_src_id;
+            const std::vector<int>* operand_compose_pairs;
+        };
+
+        struct {
+            int operand_rename_dst_id;
+            int operand_rename_src_id;
+            const std::vector<int>* operand_rename_pairs;
+        };
+
+        // one root of a forest that load_bdd read, whose variables are the forest's var_ast_ids
+        struct {
+            int operand_load_dst_id;
+            int operand_load_root_idx;
+            const bdd_forest* operand_load_forest;
+        };
+
+        struct {
+            int operand_dontcare_dst_id;
+            int operand_dontcare_src_id;
+        };
+    };
+};
+
+enum {
+    ast_id_false,
+    ast_id_true,
+    ast_id_user
+};
+
+// calls f with the ast id of every operand the instruction reads
+template<class F>
+void for_each_src_ast_id(const bdd_instr& inst, F f)
+{
+    switch (inst.opcode)
+    {
+    case bdd_instr::opcode_newinput:
+        break;
+    case bdd_instr::opcode_and:
+        f(inst.operand_and_src1_id);
+        f(inst.operand_and_src2_id);
+        break;
+    case bdd_instr::opcode_or:
+        f(inst.operand_or_src1_id);
+        f(inst.operand_or_src2_id);
+        break;
+    case bdd_instr::opcode_xor:
+        f(inst.operand_xor_src1_id);
+        f(inst.operand_xor_src2_id);
+        break;
+    case bdd_instr::opcode_not:
+        f(inst.operand_not_src_id);
+        break;
+    case bdd_instr::opcode_ite:
+        f(inst.operand_ite_if_id);
+        f(inst.operand_ite_then_id);
+        f(inst.operand_ite_else_id);
+        break;
+    case bdd_instr::opcode_exists:
+        f(inst.operand_exists_src_id);
+        f(inst.operand_exists_cube_id);
+        break;
+    case bdd_instr::opcode_forall:
+        f(inst.operand_forall_src_id);
+        f(inst.operand_forall_cube_id);
+        break;
+    case bdd_instr::opcode_and_exists:
+        f(inst.operand_and_exists_src1_id);
+        f(inst.operand_and_exists_src2_id);
+        f(inst.operand_and_exists_cube_id);
+        break;
+    case bdd_instr::opcode_restrict:
+        f(inst.operand_restrict_src_id);
+        f(inst.operand_restrict_care_id);
+        break;
+    case bdd_instr::opcode_constrain:
+        f(inst.operand_constrain_src_id);
+        f(inst.operand_constrain_care_id);
+        break;
+    case bdd_instr::opcode_cofactor:
+        f(inst.operand_cofactor_src_id);
+        f(inst.operand_cofactor_cube_id);
+        break;
+    case bdd_instr::opcode_compose:
+        f(inst.operand_compose_src_id);
+        for (int ast_id : *inst.operand_compose_pairs)
+            f(ast_id);
+        break;
+    case bdd_instr::opcode_rename:
+        f(inst.operand_rename_src_id);
+        for (int ast_id : *inst.operand_rename_pairs)
+            f(ast_id);
+        break;
+    case bdd_instr::opcode_load:
+        for (int ast_id : inst.operand_load_forest->var_ast_ids)
+            f(ast_id);
+        break;
+    default:
+        assert(false);
+    }
+}
+
+// the ast id of the node an instruction defines. every kind keeps it first.
+int get_dst_ast_id(const bdd_instr& inst)
+{
+    return inst.operand_dontcare_dst_id;
+}
+
+// --show-instrs prints every instruction as it's decoded
+bool g_show_instrs = false;
+
+// runs one instruction, reading its operands from ast2bdd and writing its result there
+// returns false if the instruction's operands aren't of the form it takes
+bool decode_instr(const bdd_instr& inst, robdd* r, robdd::node_handle* ast2bdd)
+{
+    // initial level of depth
+    uint32_t level = 0;
+
+    switch (inst.opcode)
+    {
+    case bdd_instr::opcode_newinput:
+    {
+        int ast_id = inst.operand_newinput_ast_id;
+        int var_id = inst.operand_newinput_var_id;
+        const char* ast_name = inst.operand_newinput_name->c_str();
+
+        if (g_show_instrs)
             printf("%d = new %d (%s)\n", ast_id, var_id, ast_name);
+
+        robdd::node_handle new_bdd = r->make_var(var_id);
+
+        ast2bdd[ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_and:
+    {
+        int dst_ast_id  = inst.operand_and_dst_id;
+        int src1_ast_id = inst.operand_and_src1_id;
+        int src2_ast_id = inst.operand_and_src2_id;
+
+        if (g_show_instrs)
+            printf("%d = %d AND %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
+
+        robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
+        robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
+        robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_and, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_or:
+    {
+        int dst_ast_id  = inst.operand_or_dst_id;
+        int src1_ast_id = inst.operand_or_src1_id;
+        int src2_ast_id = inst.operand_or_src2_id;
+
+        if (g_show_instrs)
+            printf("%d = %d OR %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
+
+        robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
+        robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
+        robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_or, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_xor:
+    {
+        int dst_ast_id = inst.operand_xor_dst_id;
+        int src1_ast_id = inst.operand_xor_src1_id;
+        int src2_ast_id = inst.operand_xor_src2_id;
+
+        if (g_show_instrs)
+            printf("%d = %d XOR %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
+
+        robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
+        robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
+        robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_xor, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_not:
+    {
+        int dst_ast_id = inst.operand_not_dst_id;
+        int src_ast_id = inst.operand_not_src_id;
+
+        if (g_show_instrs)
+            printf("%d = NOT %d\n", dst_ast_id, src_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle new_bdd = r->negate(src_bdd);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_ite:
+    {
+        int dst_ast_id = inst.operand_ite_dst_id;
+        int if_ast_id = inst.operand_ite_if_id;
+        int then_ast_id = inst.operand_ite_then_id;
+        int else_ast_id = inst.operand_ite_else_id;
+
+        if (g_show_instrs)
+            printf("%d = ITE %d %d %d\n", dst_ast_id, if_ast_id, then_ast_id, else_ast_id);
+
+        robdd::node_handle if_bdd = ast2bdd[if_ast_id];
+        robdd::node_handle then_bdd = ast2bdd[then_ast_id];
+        robdd::node_handle else_bdd = ast2bdd[else_ast_id];
+        robdd::node_handle new_bdd = r->ite(if_bdd, then_bdd, else_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_exists:
+    {
+        int dst_ast_id = inst.operand_exists_dst_id;
+        int src_ast_id = inst.operand_exists_src_id;
+        int cube_ast_id = inst.operand_exists_cube_id;
+
+        if (g_show_instrs)
+            printf("%d = EXISTS %d %d\n", dst_ast_id, cube_ast_id, src_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle cube_bdd = ast2bdd[cube_ast_id];
+        if (!r->is_positive_cube(cube_bdd))
+        {
+            printf("exists needs a conjunction of inputs as its cube\n");
+            return false;
+        }
+        robdd::node_handle new_bdd = r->exists(src_bdd, cube_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_forall:
+    {
+        int dst_ast_id = inst.operand_forall_dst_id;
+        int src_ast_id = inst.operand_forall_src_id;
+        int cube_ast_id = inst.operand_forall_cube_id;
+
+        if (g_show_instrs)
+            printf("%d = FORALL %d %d\n", dst_ast_id, cube_ast_id, src_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle cube_bdd = ast2bdd[cube_ast_id];
+        if (!r->is_positive_cube(cube_bdd))
+        {
+            printf("forall needs a conjunction of inputs as its cube\n");
+            return false;
+        }
+        robdd::node_handle new_bdd = r->forall(src_bdd, cube_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_and_exists:
+    {
+        int dst_ast_id = inst.operand_and_exists_dst_id;
+        int src1_ast_id = inst.operand_and_exists_src1_id;
+        int src2_ast_id = inst.operand_and_exists_src2_id;
+        int cube_ast_id = inst.operand_and_exists_cube_id;
+
+        if (g_show_instrs)
+            printf("%d = EXISTS %d (%d AND %d)\n", dst_ast_id, cube_ast_id, src1_ast_id, src2_ast_id);
+
+        robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
+        robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
+        robdd::node_handle cube_bdd = ast2bdd[cube_ast_id];
+        if (!r->is_positive_cube(cube_bdd))
+        {
+            printf("and_exists needs a conjunction of inputs as its cube\n");
+            return false;
+        }
+        robdd::node_handle new_bdd = r->and_exists(src1_bdd, src2_bdd, cube_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_restrict:
+    {
+        int dst_ast_id = inst.operand_restrict_dst_id;
+        int src_ast_id = inst.operand_restrict_src_id;
+        int care_ast_id = inst.operand_restrict_care_id;
+
+        if (g_show_instrs)
+            printf("%d = %d RESTRICT %d\n", dst_ast_id, src_ast_id, care_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle care_bdd = ast2bdd[care_ast_id];
+        robdd::node_handle new_bdd = r->restrict(src_bdd, care_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_constrain:
+    {
+        int dst_ast_id = inst.operand_constrain_dst_id;
+        int src_ast_id = inst.operand_constrain_src_id;
+        int care_ast_id = inst.operand_constrain_care_id;
+
+        if (g_show_instrs)
+            printf("%d = %d CONSTRAIN %d\n", dst_ast_id, src_ast_id, care_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle care_bdd = ast2bdd[care_ast_id];
+        robdd::node_handle new_bdd = r->constrain(src_bdd, care_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_cofactor:
+    {
+        int dst_ast_id = inst.operand_cofactor_dst_id;
+        int src_ast_id = inst.operand_cofactor_src_id;
+        int cube_ast_id = inst.operand_cofactor_cube_id;
+
+        if (g_show_instrs)
+            printf("%d = %d COFACTOR %d\n", dst_ast_id, src_ast_id, cube_ast_id);
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle cube_bdd = ast2bdd[cube_ast_id];
+        if (!r->is_literal_cube(cube_bdd))
+        {
+            printf("cofactor needs a conjunction of inputs and negated inputs as its cube\n");
+            return false;
+        }
+        robdd::node_handle new_bdd = r->cofactor(src_bdd, cube_bdd, level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_compose:
+    {
+        int dst_ast_id = inst.operand_compose_dst_id;
+        int src_ast_id = inst.operand_compose_src_id;
+        const std::vector<int>& pairs = *inst.operand_compose_pairs;
+
+        if (g_show_instrs)
+        {
+            printf("%d = COMPOSE %d", dst_ast_id, src_ast_id);
+            for (size_t p = 0; p < pairs.size(); p += 2)
+                printf(" %d:=%d", pairs[p], pairs[p + 1]);
+            printf("\n");
+        }
+
+        std::vector<uint32_t> vars;
+        std::vector<robdd::node_handle> gs;
+        for (size_t p = 0; p < pairs.size(); p += 2)
+        {
+            vars.push_back(r->get_var(ast2bdd[pairs[p]]));
+            gs.push_back(ast2bdd[pairs[p + 1]]);
+        }
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle new_bdd = r->compose(src_bdd, (int)vars.size(), vars.data(), gs.data(), level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_rename:
+    {
+        int dst_ast_id = inst.operand_rename_dst_id;
+        int src_ast_id = inst.operand_rename_src_id;
+        const std::vector<int>& pairs = *inst.operand_rename_pairs;
+
+        if (g_show_instrs)
+        {
+            printf("%d = RENAME %d", dst_ast_id, src_ast_id);
+            for (size_t p = 0; p < pairs.size(); p += 2)
+                printf(" %d:=%d", pairs[p], pairs[p + 1]);
+            printf("\n");
+        }
+
+        std::vector<uint32_t> from_vars;
+        std::vector<uint32_t> to_vars;
+        for (size_t p = 0; p < pairs.size(); p += 2)
+        {
+            from_vars.push_back(r->get_var(ast2bdd[pairs[p]]));
+            to_vars.push_back(r->get_var(ast2bdd[pairs[p + 1]]));
+        }
+
+        robdd::node_handle src_bdd = ast2bdd[src_ast_id];
+        robdd::node_handle new_bdd = r->rename(src_bdd, (int)from_vars.size(), from_vars.data(), to_vars.data(), level);
+
+        ast2bdd[dst_ast_id] = new_bdd;
+
+        break;
+    }
+    case bdd_instr::opcode_load:
+        // done by decode_loads before the rest of the wave, together with the other roots of its forest
+        break;
+    default:
+        assert(false);
+    }
+
+    return true;
+}
+
+// runs the loads among a wave's instructions a forest at a time, so a forest's shared nodes are imported once
+// for all of its roots rather than once per root
+void decode_loads(const bdd_instr* instrs, const int* wave_instrs, int num_wave_instrs, robdd* r, robdd::node_handle* ast2bdd)
+{
+    std::map<const bdd_forest*, std::vector<const bdd_instr*>> loads_by_forest;
+    for (int j = 0; j < num_wave_instrs; j++)
+    {
+        const bdd_instr& inst = instrs[wave_instrs[j]];
+        if (inst.opcode == bdd_instr::opcode_load)
+        {
+            loads_by_forest[inst.operand_load_forest].push_back(&inst);
+        }
+    }
+
+    for (const auto& forest_loads : loads_by_forest)
+    {
+        const bdd_forest& forest = *forest_loads.first;
+        const std::vector<const bdd_instr*>& loads = forest_loads.second;
+
+        std::vector<int> root_idxs;
+        for (const bdd_instr* inst : loads)
+        {
+            if (g_show_instrs)
+                printf("%d = LOAD %s\n", inst->operand_load_dst_id, forest.root_names[inst->operand_load_root_idx].c_str());
+            root_idxs.push_back(inst->operand_load_root_idx);
+        }
+
+        std::vector<robdd::node_handle> var_bdds;
+        for (int ast_id : forest.var_ast_ids)
+        {
+            var_bdds.push_back(ast2bdd[ast_id]);
+        }
+
+        std::vector<robdd::node_handle> new_bdds(loads.size());
+        import_forest_roots(r, forest, (int)loads.size(), root_idxs.data(), var_bdds.data(), new_bdds.data());
+
+        for (size_t k = 0; k < loads.size(); k++)
+        {
+            ast2bdd[loads[k]->operand_load_dst_id] = new_bdds[k];
+        }
+    }
+}
+
+// returns false if an instruction couldn't be decoded, leaving roots unset
+bool decode(
+    int num_instrs, bdd_instr* instrs,
+    int num_user_ast_nodes,
+    int num_root_ast_ids, int* root_ast_ids,
+    robdd* r,
+    robdd::node_handle* roots)
+{
+#ifdef ITTPROFILE
+    __itt_task_begin(robdd_itt_domain, __itt_null, __itt_null, robdd_itt_decode_task);
+#endif
+
+    robdd::node_handle false_node = r->get_false();
+    robdd::node_handle true_node = r->get_true();
+
+    int num_ast_nodes = ast_id_user + num_user_ast_nodes;
+
+    std::vector<robdd::node_handle> astnode2bddnode(num_ast_nodes, robdd::invalid_handle);
+    astnode2bddnode[ast_id_false] = false_node;
+    astnode2bddnode[ast_id_true] = true_node;
+
+    // instructions run in waves: each one goes in the wave after the last one that defines its operands,
+    // and the instructions of a wave run concurrently. garbage is only collected between waves.
+    std::vector<int> wave_of_ast(num_ast_nodes, -1);
+    std::vector<int> wave_of_instr(num_instrs);
+    int num_waves = 0;
+    for (int i = 0; i < num_instrs; i++)
+    {
+        int wave = 0;
+        for_each_src_ast_id(instrs[i], [&](int src_ast_id) { wave = std::max(wave, wave_of_ast[src_ast_id] + 1); });
+        wave_of_instr[i] = wave;
+        wave_of_ast[get_dst_ast_id(instrs[i])] = wave;
+        num_waves = std::max(num_waves, wave + 1);
+    }
+
+    // the instructions of each wave, in program order
+    std::vector<int> wave_begin(num_waves + 1, 0);
+    for (int i = 0; i < num_instrs; i++)
+    {
+        wave_begin[wave_of_instr[i] + 1]++;
+    }
+    for (int wave = 0; wave < num_waves; wave++)
+    {
+        wave_begin[wave + 1] += wave_begin[wave];
+    }
+    std::vector<int> wave_instrs(num_instrs);
+    {
+        std::vector<int> next(wave_begin.begin(), wave_begin.end() - 1);
+        for (int i = 0; i < num_instrs; i++)
+        {
+            wave_instrs[next[wave_of_instr[i]]++] = i;
+        }
+    }
+
+    // the last wave that reads each ast node. roots are read "after" the last wave.
+    // garbage collection keeps only the bdds of ast nodes that are still going to be read.
+    std::vector<int> last_use(num_ast_nodes, -1);
+    for (int i = 0; i < num_instrs; i++)
+    {
+        for_each_src_ast_id(instrs[i], [&](int src_ast_id) { last_use[src_ast_id] = std::max(last_use[src_ast_id], wave_of_instr[i]); });
+    }
+    for (int root_ast_idx = 0; root_ast_idx < num_root_ast_ids; root_ast_idx++)
+    {
+        last_use[root_ast_ids[root_ast_idx]] = num_waves;
+    }
+
+    std::vector<robdd::node_handle> live_bdds;
+
+    robdd::node_handle* ast2bdd = astnode2bddnode.data();
+
+    for (int wave = 0; wave < num_waves; wave++)
+    {
+        bool reorder = r->should_reorder();
+        if (reorder || r->should_collect_garbage())
+        {
+            live_bdds.clear();
+            for (int ast_id = ast_id_user; ast_id < num_ast_nodes; ast_id++)
+            {
+                if (last_use[ast_id] < wave)
+                {
+                    ast2bdd[ast_id] = robdd::invalid_handle;
+                }
+                else if (ast2bdd[ast_id] != robdd::invalid_handle)
+                {
+                    live_bdds.push_back(ast2bdd[ast_id]);
+                }
+            }
+
+            if (reorder)
+            {
+                r->reorder((int)live_bdds.size(), live_bdds.data());
+            }
+            else
+            {
+                r->collect_garbage((int)live_bdds.size(), live_bdds.data());
+            }
+        }
+
+        int begin = wave_begin[wave];
+        int end = wave_begin[wave + 1];
+        decode_loads(instrs, wave_instrs.data() + begin, end - begin, r, ast2bdd);
+        std::atomic<bool> ok(true);
+#ifndef SINGLETHREADED
+        if (end - begin > 1)
+        {
+            tbb::parallel_for(begin, end, [&](int j) {
+                if (!decode_instr(instrs[wave_instrs[j]], r, ast2bdd))
+                {
+                    ok.store(false, std::memory_order_relaxed);
+                }
+            });
+        }
+        else
+#endif
+        {
+            for (int j = begin; j < end && ok.load(std::memory_order_relaxed); j++)
+            {
+                ok.store(decode_instr(instrs[wave_instrs[j]], r, ast2bdd), std::memory_order_relaxed);
+            }
+        }
+        if (!ok.load(std::memory_order_relaxed))
+        {
+#ifdef ITTPROFILE
+            __itt_task_end(robdd_itt_domain);
+#endif
+            return false;
+        }
+    }
+
+    for (int root_ast_idx = 0; root_ast_idx < num_root_ast_ids; root_ast_idx++)
+    {
+        roots[root_ast_idx] = ast2bdd[root_ast_ids[root_ast_idx]];
+    }
+
+#ifdef ITTPROFILE
+    __itt_task_end(robdd_itt_domain);
+#endif
+
+    return true;
+}
+
+struct var_order
+{
+    enum {
+        declared,
+        dfs,
+        interleave,
+        force
+    };
+};
+
+// the instruction graph that the static ordering heuristics work on
+class instr_graph
+{
+    int num_instrs;
+    const bdd_instr* instrs;
+
+    // the instruction that defines each ast node, or -1 for the constants
+    std::vector<int> definition;
+
+    int num_vars;
+
+    std::vector<int> visited;
+    int visit_stamp;
+
+    // variables that no root depends on go last, in declaration order
+    void append_unplaced(std::vector<int>& order, std::vector<bool>& placed) const
+    {
+        for (int var = 0; var < num_vars; var++)
+        {
+            if (!placed[var])
+            {
+                placed[var] = true;
+                order.push_back(var);
+            }
+        }
+    }
+
+public:
+    // num_vars counts every input, including any whose instruction isn't in instrs
+    instr_graph(int num_instrs, const bdd_instr* instrs, int num_user_ast_nodes, int num_vars)
+        : num_instrs(num_instrs)
+        , instrs(instrs)
+        , definition(ast_id_user + num_user_ast_nodes, -1)
+        , num_vars(num_vars)
+        , visited(ast_id_user + num_user_ast_nodes, 0)
+        , visit_stamp(0)
+    {
+        for (int i = 0; i < num_instrs; i++)
+        {
+            definition[instrs[i].operand_dontcare_dst_id] = i;
+        }
+    }
+
+    int get_num_vars() const
+    {
+        return num_vars;
+    }
+
+    // calls f with every ast node in the fanin of the roots, once each, depth first and leftmost operand first.
+    // every call starts from scratch, so nodes shared with earlier calls are visited again.
+    template<class F>
+    void for_each_fanin(int num_roots, const int* root_ast_ids, F f)
+    {
+        visit_stamp++;
+
+        // an explicit stack, since instruction chains can be far deeper than the call stack
+        std::vector<int> stack(root_ast_ids, root_ast_ids + num_roots);
+        std::reverse(stack.begin(), stack.end());
+        while (!stack.empty())
+        {
+            int ast_id = stack.back();
+            stack.pop_back();
+
+            if (definition[ast_id] == -1 || visited[ast_id] == visit_stamp)
+            {
+                continue;
+            }
+            visited[ast_id] = visit_stamp;
+
+            f(ast_id);
+
+            size_t first_src = stack.size();
+            for_each_src_ast_id(instrs[definition[ast_id]], [&](int src_ast_id) { stack.push_back(src_ast_id); });
+            std::reverse(stack.begin() + first_src, stack.end());
+        }
+    }
+
+    template<class F>
+    void for_each_fanin(int root_ast_id, F f)
+    {
+        for_each_fanin(1, &root_ast_id, f);
+    }
+
+    template<class F>
+    void for_each_fanin_var(int root_ast_id, F f)
+    {
+        for_each_fanin(root_ast_id, [&](int ast_id) {
+            const bdd_instr& inst = instrs[definition[ast_id]];
+            if (inst.opcode == bdd_instr::opcode_newinput)
+            {
+                f(inst.operand_newinput_var_id);
+            }
+        });
+    }
+
+    // whether each instruction is in the fanin of some root. the others can't change any root.
+    std::vector<bool> get_cone(int num_roots, const int* root_ast_ids)
+    {
+        std::vector<bool> in_cone(num_instrs);
+        for_each_fanin(num_roots, root_ast_ids, [&](int ast_id) { in_cone[definition[ast_id]] = true; });
+        return in_cone;
+    }
+
+    // variables in the order a depth first traversal of the roots first reaches them
+    std::vector<int> order_dfs(int num_roots, const int* root_ast_ids)
+    {
+        std::vector<int> order;
+        std::vector<bool> placed(num_vars);
+
+        for (int root_idx = 0; root_idx < num_roots; root_idx++)
+        {
+            for_each_fanin_var(root_ast_ids[root_idx], [&](int var) {
+                if (!placed[var])
+                {
+                    placed[var] = true;
+                    order.push_back(var);
+                }
+            });
+        }
+
+        append_unplaced(order, placed);
+        return order;
+    }
+
+    // like dfs, but each root's new variables go right after the last already placed variable
+    // the traversal passed, so variables that meet in a root's fanin end up next to each other
+    std::vector<int> order_interleave(int num_roots, const int* root_ast_ids)
+    {
+        std::vector<int> order;
+        std::vector<bool> placed(num_vars);
+
+        for (int root_idx = 0; root_idx < num_roots; root_idx++)
+        {
+            size_t insert_at = order.size();
+            for_each_fanin_var(root_ast_ids[root_idx], [&](int var) {
+                if (placed[var])
+                {
+                    insert_at = std::find(order.begin(), order.end(), var) - order.begin() + 1;
+                }
+                else
+                {
+                    placed[var] = true;
+                    order.insert(order.begin() + insert_at, var);
+                    insert_at++;
+                }
+            });
+        }
+
+        append_unplaced(order, placed);
+        return order;
+    }
+
+    // FORCE: every instruction is a hyperedge between the ast nodes it touches. each round moves every
+    // node to the average center of gravity of its edges, until the total edge span stops shrinking.
+    std::vector<int> order_force(int num_roots, const int* root_ast_ids)
+    {
+        static const int max_rounds = 32;
+
+        int num_ast_nodes = (int)definition.size();
+
+        std::vector<int> edge_begin(1, 0);
+        std::vector<int> edge_nodes;
+        for (int i = 0; i < num_instrs; i++)
+        {
+            if (instrs[i].opcode == bdd_instr::opcode_newinput)
+            {
+                continue;
+            }
+
+            edge_nodes.push_back(instrs[i].operand_dontcare_dst_id);
+            for_each_src_ast_id(instrs[i], [&](int src_ast_id) {
+                if (src_ast_id >= ast_id_user)
+                {
+                    edge_nodes.push_back(src_ast_id);
+                }
+            });
+            edge_begin.push_back((int)edge_nodes.size());
+        }
+        int num_edges = (int)edge_begin.size() - 1;
+
+        // start from the depth first order of the roots' fanin, and put whatever is left after it
+        std::vector<double> position(num_ast_nodes, -1.0);
+        int num_reached = 0;
+        for (int root_idx = 0; root_idx < num_roots; root_idx++)
+        {
+            for_each_fanin(root_ast_ids[root_idx], [&](int ast_id) {
+                if (position[ast_id] < 0)
+                {
+                    position[ast_id] = num_reached++;
+                }
+            });
+        }
+        for (int ast_id = ast_id_user; ast_id < num_ast_nodes; ast_id++)
+        {
+            if (position[ast_id] < 0)
+            {
+                position[ast_id] = num_reached + ast_id;
+            }
+        }
+
+        std::vector<int> ranked(num_ast_nodes - ast_id_user);
+        auto rank_positions = [&]
+        {
+            for (int ast_id = ast_id_user; ast_id < num_ast_nodes; ast_id++)
+            {
+                ranked[ast_id - ast_id_user] = ast_id;
+            }
+            std::stable_sort(ranked.begin(), ranked.end(), [&](int a, int b) { return position[a] < position[b]; });
+            for (int rank = 0; rank < (int)ranked.size(); rank++)
+            {
+                position[ranked[rank]] = rank;
+            }
+        };
+
+        auto total_span = [&]
+        {
+            double span = 0;
+            for (int e = 0; e < num_edges; e++)
+            {
+                auto bounds = std::minmax_element(edge_nodes.begin() + edge_begin[e], edge_nodes.begin() + edge_begin[e + 1],
+                    [&](int a, int b) { return position[a] < position[b]; });
+                span += position[*bounds.second] - position[*bounds.first];
+            }
+            return span;
+        };
+
+        rank_positions();
+        double span = total_span();
+        std::vector<double> best_position = position;
+
+        std::vector<double> gravity_sum(num_ast_nodes);
+        std::vector<int> num_node_edges(num_ast_nodes);
+
+        for (int round = 0; round < max_rounds; round++)
+        {
+            std::fill(gravity_sum.begin(), gravity_sum.end(), 0.0);
+            std::fill(num_node_edges.begin(), num_node_edges.end(), 0);
+
+            for (int e = 0; e < num_edges; e++)
+            {
+                double center = 0;
+                for (int j = edge_begin[e]; j < edge_begin[e + 1]; j++)
+                {
+                    center += position[edge_nodes[j]];
+                }
+                center /= edge_begin[e + 1] - edge_begin[e];
+
+                for (int j = edge_begin[e]; j < edge_begin[e + 1]; j++)
+                {
+                    gravity_sum[edge_nodes[j]] += center;
+                    num_node_edges[edge_nodes[j]]++;
+                }
+            }
+
+            for (int ast_id = ast_id_user; ast_id < num_ast_nodes; ast_id++)
+            {
+                if (num_node_edges[ast_id] != 0)
+                {
+                    position[ast_id] = gravity_sum[ast_id] / num_node_edges[ast_id];
+                }
+            }
+
+            rank_positions();
+
+            double new_span = total_span();
+            if (new_span >= span)
+            {
+                break;
+            }
+            span = new_span;
+            best_position = position;
+        }
+
+        std::vector<std::pair<double, int>> var_positions;
+        for (int ast_id = ast_id_user; ast_id < num_ast_nodes; ast_id++)
+        {
+            const bdd_instr* def = definition[ast_id] == -1 ? nullptr : &instrs[definition[ast_id]];
+            if (def && def->opcode == bdd_instr::opcode_newinput)
+            {
+                var_positions.emplace_back(best_position[ast_id], def->operand_newinput_var_id);
+            }
+        }
+        std::sort(var_positions.begin(), var_positions.end());
+
+        std::vector<int> order;
+        std::vector<bool> placed(num_vars);
+        for (const auto& var_position : var_positions)
+        {
+            order.push_back(var_position.second);
+            placed[var_position.second] = true;
+        }
+        append_unplaced(order, placed);
+        return order;
+    }
+};
+
+std::map<int, std::string> g_varid2name;
+
+void write_dot(
+    const char* title,
+    int num_roots, const robdd::node_handle* roots, const std::string* root_names, const big_uint* root_counts,
+    const robdd* r,
+    const char* fn)
+{
+    robdd::node_handle true_node = r->get_true();
+
+    FILE* f = fopen(fn, "w");
+    
+    if (!f)
+    {
+        printf("failed to open %s\n", fn);
+        return;
+    }
+
+    fprintf(f, "digraph {\n");
+
+    fprintf(f, "  labelloc=\"t\";\n");
+    fprintf(f, "  label=\"%s\";\n", title);
+
+    // nodes are drawn once per regular handle. complemented edges get a hollow dot as arrowhead,
+    // so false is drawn as a complemented edge to the 1 box.
+    std::vector<robdd::node_handle> nodes2add;
+
+    std::unordered_set<robdd::node_handle> added;
+    added.insert(true_node);
+
+    std::unordered_set<robdd::node_handle> declared;
+
+    auto declare = [&](robdd::node_handle n)
+    {
+        if (!declared.insert(n).second)
+        {
+            return;
+        }
+
+        if (n == true_node)
+        {
+            fprintf(f, "  n%x [label=\"1\",shape=box];\n", true_node);
+        }
+        else
+        {
+            fprintf(f, "  n%x [label=\"%s\"];\n", n, g_varid2name.at(r->get_var(n)).c_str());
+        }
+    };
+
+    auto arrowhead = [](robdd::node_handle edge)
+    {
+        return robdd::is_complemented(edge) ? "odot" : "normal";
+    };
+
+    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    {
+        robdd::node_handle root = robdd::regular(roots[root_idx]);
+        declare(root);
+        nodes2add.push_back(root);
+    }
+
+    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    {
+        fprintf(f, "  r%d [label=\"%s\\n%s solutions\",style=filled];\n", root_idx, root_names[root_idx].c_str(), root_counts[root_idx].to_string().c_str());
+        fprintf(f, "  r%d -> n%x [style=solid,arrowhead=%s];\n", root_idx, robdd::regular(roots[root_idx]), arrowhead(roots[root_idx]));
+    }
+
+    while (!nodes2add.empty())
+    {
+        robdd::node_handle n = nodes2add.back();
+        nodes2add.pop_back();
+
+        if (added.find(n) != added.end())
+            continue;
+
+        const robdd::node_handle children[] = { r->get_lo(n), r->get_hi(n) };
+        for (int child_idx = 0; child_idx < 2; child_idx++)
+        {
+            robdd::node_handle child = robdd::regular(children[child_idx]);
+
+            declare(child);
+
+            fprintf(f, "  n%x -> n%x [style=%s,arrowhead=%s];\n", n, child, child_idx == 0 ? "dotted" : "solid", arrowhead(children[child_idx]));
+
+            if (added.find(child) == added.end())
+                nodes2add.push_back(child);
+        }
+
+        added.insert(n);
+    }
+
+    fprintf(f, "}\n");
+
+    fclose(f);
+
+#ifdef _WIN32
+    std::string dotcmd = std::string("packages\\Graphviz.2.38.0.2\\dot.exe") + " -Tpng " + fn + " -o " + fn + ".png";
+    if (system(dotcmd.c_str()) == 0)
+    {
+        std::string pngcmd = std::string(fn) + ".png";
+        system(pngcmd.c_str());
+    }
+#else
+    // no viewer to hand the png to, so just render it next to the dot file
+    std::string dotcmd = std::string("dot -Tpng ") + fn + " -o " + fn + ".png";
+    if (system(dotcmd.c_str()) != 0)
+    {
+        printf("failed to run dot on %s\n", fn);
+    }
 #endif
+}
+
+std::vector<bdd_instr> g_bdd_instructions;
+// the pairs of every compose and rename, which keep their address as more are added
+std::deque<std::vector<int>> g_substitution_pairs;
+// the forests that load_bdd read, which keep their address as more are added
+std::deque<bdd_forest> g_loaded_forests;
+std::unordered_set<int> g_input_ast_ids;
+
+// what the after_build hook can query, which is only there while it runs
+robdd* g_built_bdd = nullptr;
+std::unordered_map<int, robdd::node_handle> g_built_roots;
+int g_next_ast_id = ast_id_user;
+int g_num_variables = 0;
+
+int l_input_newindex(lua_State* L)
+{
+    luaL_error(L, "Cannot write to inputs table");
+    return 0;
+}
+
+int l_input_index(lua_State* L)
+{
+    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
+    *ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
+
+    auto varid2name = g_varid2name.emplace(g_num_variables, luaL_checkstring(L, 2)).first;
+    
+    g_num_variables += 1;
+
+    g_input_ast_ids.insert(*ast_id);
+
+    bdd_instr new_instr;
+    new_instr.opcode = bdd_instr::opcode_newinput;
+    new_instr.operand_newinput_ast_id = *ast_id;
+    new_instr.operand_newinput_var_id = varid2name->first;
+    new_instr.operand_newinput_name = &varid2name->second;
+    g_bdd_instructions.push_back(new_instr);
+
+    luaL_newmetatable(L, "ast");
+    lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, -2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -5);
+
+    return 1;
+}
+
+int arg_to_ast(lua_State* L, int argidx)
+{
+    if (lua_isboolean(L, argidx))
+        return lua_toboolean(L, argidx) ? ast_id_true : ast_id_false;
+    else
+        return *(int*)luaL_checkudata(L, argidx, "ast");
+}
+
+int push_ast(lua_State* L, int ast_id)
+{
+    int* ud = (int*)lua_newuserdata(L, sizeof(int));
+    *ud = ast_id;
+
+    luaL_newmetatable(L, "ast");
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+// structural hashing: an expression that was already recorded gives back its ast id instead of a new instruction.
+// commutative operands are keyed smallest first, and not is keyed with src2 = -1. only ite and and_exists use src3.
+struct ast_key
+{
+    int opcode;
+    int src1_id;
+    int src2_id;
+    int src3_id = -1;
+
+    bool operator==(const ast_key& other) const
+    {
+        return opcode == other.opcode && src1_id == other.src1_id && src2_id == other.src2_id && src3_id == other.src3_id;
+    }
+};
+
+struct ast_key_hash
+{
+    size_t operator()(const ast_key& k) const
+    {
+        uint64_t h = (uint64_t)(uint32_t)k.src1_id * 0x9E3779B97F4A7C15ull;
+        h ^= ((uint64_t)(uint32_t)k.src2_id << 4 | (uint32_t)k.opcode) * 0xC2B2AE3D27D4EB4Full;
+        h ^= (uint64_t)(uint32_t)k.src3_id * 0x165667B19E3779F9ull;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+std::unordered_map<ast_key, int, ast_key_hash> g_hashed_ast_ids;
+
+ast_key commutative_key(int opcode, int ast1_id, int ast2_id)
+{
+    return ast1_id < ast2_id ? ast_key{ opcode, ast1_id, ast2_id } : ast_key{ opcode, ast2_id, ast1_id };
+}
+
+// the ast id of not ast_id, or -1 if it was never recorded
+int find_negation(int ast_id)
+{
+    if (ast_id == ast_id_true)
+        return ast_id_false;
+    if (ast_id == ast_id_false)
+        return ast_id_true;
+
+    auto found = g_hashed_ast_ids.find(ast_key{ bdd_instr::opcode_not, ast_id, -1 });
+    return found == g_hashed_ast_ids.end() ? -1 : found->second;
+}
+
+int record_not(int src_ast_id)
+{
+    int negation = find_negation(src_ast_id);
+    if (negation != -1)
+        return negation;
+
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
+
+    // both ways round, so that not not x is x again
+    g_hashed_ast_ids.emplace(ast_key{ bdd_instr::opcode_not, src_ast_id, -1 }, ast_id);
+    g_hashed_ast_ids.emplace(ast_key{ bdd_instr::opcode_not, ast_id, -1 }, src_ast_id);
+
+    bdd_instr not_instr;
+    not_instr.opcode = bdd_instr::opcode_not;
+    not_instr.operand_not_dst_id = ast_id;
+    not_instr.operand_not_src_id = src_ast_id;
+    g_bdd_instructions.push_back(not_instr);
+
+    return ast_id;
+}
+
+int record_and(int ast1_id, int ast2_id)
+{
+    if (ast1_id == ast_id_false || ast2_id == ast_id_false || ast2_id == find_negation(ast1_id))
+        return ast_id_false;
+    if (ast1_id == ast_id_true || ast1_id == ast2_id)
+        return ast2_id;
+    if (ast2_id == ast_id_true)
+        return ast1_id;
+
+    ast_key key = commutative_key(bdd_instr::opcode_and, ast1_id, ast2_id);
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
+
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
+
+    bdd_instr and_instr;
+    and_instr.opcode = bdd_instr::opcode_and;
+    and_instr.operand_and_dst_id = ast_id;
+    and_instr.operand_and_src1_id = key.src1_id;
+    and_instr.operand_and_src2_id = key.src2_id;
+    g_bdd_instructions.push_back(and_instr);
+
+    return ast_id;
+}
+
+int record_or(int ast1_id, int ast2_id)
+{
+    if (ast1_id == ast_id_true || ast2_id == ast_id_true || ast2_id == find_negation(ast1_id))
+        return ast_id_true;
+    if (ast1_id == ast_id_false || ast1_id == ast2_id)
+        return ast2_id;
+    if (ast2_id == ast_id_false)
+        return ast1_id;
+
+    ast_key key = commutative_key(bdd_instr::opcode_or, ast1_id, ast2_id);
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
+
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
+
+    bdd_instr or_instr;
+    or_instr.opcode = bdd_instr::opcode_or;
+    or_instr.operand_or_dst_id = ast_id;
+    or_instr.operand_or_src1_id = key.src1_id;
+    or_instr.operand_or_src2_id = key.src2_id;
+    g_bdd_instructions.push_back(or_instr);
+
+    return ast_id;
+}
+
+int record_xor(int ast1_id, int ast2_id)
+{
+    if (ast1_id == ast2_id)
+        return ast_id_false;
+    if (ast2_id == find_negation(ast1_id))
+        return ast_id_true;
+    if (ast1_id == ast_id_false)
+        return ast2_id;
+    if (ast2_id == ast_id_false)
+        return ast1_id;
+    if (ast1_id == ast_id_true)
+        return record_not(ast2_id);
+    if (ast2_id == ast_id_true)
+        return record_not(ast1_id);
+
+    ast_key key = commutative_key(bdd_instr::opcode_xor, ast1_id, ast2_id);
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
+
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
+
+    bdd_instr xor_instr;
+    xor_instr.opcode = bdd_instr::opcode_xor;
+    xor_instr.operand_xor_dst_id = ast_id;
+    xor_instr.operand_xor_src1_id = key.src1_id;
+    xor_instr.operand_xor_src2_id = key.src2_id;
+    g_bdd_instructions.push_back(xor_instr);
+
+    return ast_id;
+}
+
+int l_and(lua_State* L)
+{
+    return push_ast(L, record_and(arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
+
+int l_or(lua_State* L)
+{
+    return push_ast(L, record_or(arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
+
+int l_xor(lua_State* L)
+{
+    return push_ast(L, record_xor(arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
+
+int l_not(lua_State* L)
+{
+    return push_ast(L, record_not(arg_to_ast(L, 1)));
+}
+
+// the operands of and_all and or_all, given as one array or as separate arguments
+std::vector<int> args_to_operands(lua_State* L)
+{
+    std::vector<int> operands;
+    if (lua_istable(L, 1))
+    {
+        int n = (int)lua_objlen(L, 1);
+        for (int i = 1; i <= n; i++)
+        {
+            lua_rawgeti(L, 1, i);
+            operands.push_back(arg_to_ast(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    else
+    {
+        for (int argidx = 1; argidx <= lua_gettop(L); argidx++)
+        {
+            operands.push_back(arg_to_ast(L, argidx));
+        }
+    }
+    return operands;
+}
+
+// combines neighbouring operands a round at a time, so the instructions form a balanced tree.
+// decode runs each level of it as one wave, where a left-deep chain would be one apply after another.
+template<class Record>
+int record_balanced(std::vector<int> operands, int identity_ast_id, Record record)
+{
+    if (operands.empty())
+        return identity_ast_id;
+
+    while (operands.size() > 1)
+    {
+        size_t num_combined = 0;
+        for (size_t i = 0; i + 1 < operands.size(); i += 2)
+        {
+            operands[num_combined++] = record(operands[i], operands[i + 1]);
+        }
+        if (operands.size() % 2 != 0)
+        {
+            operands[num_combined++] = operands.back();
+        }
+        operands.resize(num_combined);
+    }
+
+    return operands[0];
+}
+
+int l_and_all(lua_State* L)
+{
+    return push_ast(L, record_balanced(args_to_operands(L), ast_id_true, record_and));
+}
+
+int l_or_all(lua_State* L)
+{
+    return push_ast(L, record_balanced(args_to_operands(L), ast_id_false, record_or));
+}
 
-            robdd::node_handle new_bdd = r->make_node(var_id, false_node, true_node);
+int record_ite(int if_ast_id, int then_ast_id, int else_ast_id)
+{
+    if (if_ast_id == ast_id_true || then_ast_id == else_ast_id)
+        return then_ast_id;
+    if (if_ast_id == ast_id_false)
+        return else_ast_id;
+    if (then_ast_id == ast_id_true || then_ast_id == if_ast_id)
+        return record_or(if_ast_id, else_ast_id);
+    if (else_ast_id == ast_id_false || else_ast_id == if_ast_id)
+        return record_and(if_ast_id, then_ast_id);
+    if (then_ast_id == ast_id_false)
+        return record_and(record_not(if_ast_id), else_ast_id);
+    if (else_ast_id == ast_id_true)
+        return record_or(record_not(if_ast_id), then_ast_id);
+
+    ast_key key{ bdd_instr::opcode_ite, if_ast_id, then_ast_id, else_ast_id };
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
+
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
 
-            ast2bdd[ast_id] = new_bdd;
+    bdd_instr ite_instr;
+    ite_instr.opcode = bdd_instr::opcode_ite;
+    ite_instr.operand_ite_dst_id = ast_id;
+    ite_instr.operand_ite_if_id = if_ast_id;
+    ite_instr.operand_ite_then_id = then_ast_id;
+    ite_instr.operand_ite_else_id = else_ast_id;
+    g_bdd_instructions.push_back(ite_instr);
 
-            inst_dst_ast_id = ast_id;
-            inst_dst_node = new_bdd;
+    return ast_id;
+}
 
-            break;
-        }
-        case bdd_instr::opcode_and:
-        {
-            int dst_ast_id  = inst.operand_and_dst_id;
-            int src1_ast_id = inst.operand_and_src1_id;
-            int src2_ast_id = inst.operand_and_src2_id;
+// exists, forall, restrict, constrain and cofactor, which all take an ast and a cube or care set, and leave
+// the ast as it is when that's true. their operands line up as dst, src and the cube or care set.
+int record_with_cube(int opcode, int src_ast_id, int cube_ast_id)
+{
+    if (cube_ast_id == ast_id_true)
+        return src_ast_id;
 
-#ifdef SHOW_INSTRS
-            printf("%d = %d AND %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
-#endif
+    ast_key key{ opcode, src_ast_id, cube_ast_id };
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
 
-            robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
-            robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
-            robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_and, level);
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
 
-            ast2bdd[dst_ast_id] = new_bdd;
+    bdd_instr instr;
+    instr.opcode = opcode;
+    instr.operand_exists_dst_id = ast_id;
+    instr.operand_exists_src_id = src_ast_id;
+    instr.operand_exists_cube_id = cube_ast_id;
+    g_bdd_instructions.push_back(instr);
 
-            inst_dst_ast_id = dst_ast_id;
-            inst_dst_node = new_bdd;
+    return ast_id;
+}
 
-            break;
-        }
-        case bdd_instr::opcode_or:
-        {
-            int dst_ast_id  = inst.operand_or_dst_id;
-            int src1_ast_id = inst.operand_or_src1_id;
-            int src2_ast_id = inst.operand_or_src2_id;
+int record_and_exists(int ast1_id, int ast2_id, int cube_ast_id)
+{
+    if (cube_ast_id == ast_id_true)
+        return record_and(ast1_id, ast2_id);
 
-#ifdef SHOW_INSTRS
-            printf("%d = %d OR %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
-#endif
+    ast_key key = commutative_key(bdd_instr::opcode_and_exists, ast1_id, ast2_id);
+    key.src3_id = cube_ast_id;
+    auto hashed = g_hashed_ast_ids.emplace(key, g_next_ast_id);
+    if (!hashed.second)
+        return hashed.first->second;
 
-            robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
-            robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
-            robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_or, level);
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
 
-            ast2bdd[dst_ast_id] = new_bdd;
+    bdd_instr and_exists_instr;
+    and_exists_instr.opcode = bdd_instr::opcode_and_exists;
+    and_exists_instr.operand_and_exists_dst_id = ast_id;
+    and_exists_instr.operand_and_exists_src1_id = key.src1_id;
+    and_exists_instr.operand_and_exists_src2_id = key.src2_id;
+    and_exists_instr.operand_and_exists_cube_id = cube_ast_id;
+    g_bdd_instructions.push_back(and_exists_instr);
 
-            inst_dst_ast_id = dst_ast_id;
-            inst_dst_node = new_bdd;
+    return ast_id;
+}
 
-            break;
-        }
-        case bdd_instr::opcode_xor:
-        {
-            int dst_ast_id = inst.operand_xor_dst_id;
-            int src1_ast_id = inst.operand_xor_src1_id;
-            int src2_ast_id = inst.operand_xor_src2_id;
+int l_ite(lua_State* L)
+{
+    return push_ast(L, record_ite(arg_to_ast(L, 1), arg_to_ast(L, 2), arg_to_ast(L, 3)));
+}
 
-#ifdef SHOW_INSTRS
-            printf("%d = %d XOR %d\n", dst_ast_id, src1_ast_id, src2_ast_id);
-#endif
+int l_exists(lua_State* L)
+{
+    return push_ast(L, record_with_cube(bdd_instr::opcode_exists, arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
 
-            robdd::node_handle src1_bdd = ast2bdd[src1_ast_id];
-            robdd::node_handle src2_bdd = ast2bdd[src2_ast_id];
-            robdd::node_handle new_bdd = r->apply(src1_bdd, src2_bdd, robdd::opcode::bdd_xor, level);
+int l_forall(lua_State* L)
+{
+    return push_ast(L, record_with_cube(bdd_instr::opcode_forall, arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
 
-            ast2bdd[dst_ast_id] = new_bdd;
+int l_and_exists(lua_State* L)
+{
+    return push_ast(L, record_and_exists(arg_to_ast(L, 1), arg_to_ast(L, 2), arg_to_ast(L, 3)));
+}
 
-            inst_dst_ast_id = dst_ast_id;
-            inst_dst_node = new_bdd;
+int l_restrict(lua_State* L)
+{
+    return push_ast(L, record_with_cube(bdd_instr::opcode_restrict, arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
 
-            break;
-        }
-        case bdd_instr::opcode_not:
-        {
-            int dst_ast_id = inst.operand_not_dst_id;
-            int src_ast_id = inst.operand_not_src_id;
+int l_constrain(lua_State* L)
+{
+    return push_ast(L, record_with_cube(bdd_instr::opcode_constrain, arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
 
-#ifdef SHOW_INSTRS
-            printf("%d = NOT %d\n", dst_ast_id, src_ast_id);
-#endif
+int l_cofactor(lua_State* L)
+{
+    return push_ast(L, record_with_cube(bdd_instr::opcode_cofactor, arg_to_ast(L, 1), arg_to_ast(L, 2)));
+}
 
-            robdd::node_handle src_bdd = ast2bdd[src_ast_id];
-            robdd::node_handle new_bdd = r->apply(src_bdd, true_node, robdd::opcode::bdd_xor, level);
+// reads a table of input = replacement into g_substitution_pairs
+const std::vector<int>* arg_to_substitution_pairs(lua_State* L, int argidx, bool inputs_only)
+{
+    luaL_checktype(L, argidx, LUA_TTABLE);
 
-            ast2bdd[dst_ast_id] = new_bdd;
+    g_substitution_pairs.emplace_back();
+    std::vector<int>& pairs = g_substitution_pairs.back();
 
-            inst_dst_ast_id = dst_ast_id;
-            inst_dst_node = new_bdd;
+    lua_pushnil(L);
+    while (lua_next(L, argidx))
+    {
+        int var_ast_id = arg_to_ast(L, -2);
+        int replacement_ast_id = arg_to_ast(L, -1);
+        if (!g_input_ast_ids.count(var_ast_id))
+            luaL_error(L, "Only inputs can be substituted");
+        if (inputs_only && !g_input_ast_ids.count(replacement_ast_id))
+            luaL_error(L, "Inputs can only be renamed to inputs");
 
-            break;
-        }
-        default:
-            assert(false);
-        }
+        pairs.push_back(var_ast_id);
+        pairs.push_back(replacement_ast_id);
 
-        for (int root_ast_idx = 0; root_ast_idx < num_root_ast_ids; root_ast_idx++)
-        {
-            if (inst_dst_ast_id == root_ast_ids[root_ast_idx])
-            {
-                roots[root_ast_idx] = inst_dst_node;
-            }
-        }
+        lua_pop(L, 1);
     }
 
-#ifdef ITTPROFILE
-    __itt_task_end(robdd_itt_domain);
-#endif
+    return &pairs;
 }
 
-std::map<int, std::string> g_varid2name;
-
-void write_dot(
-    const char* title,
-    int num_roots, const robdd::node_handle* roots, const std::string* root_names,
-    const robdd* r,
-    const char* fn)
+// compose and rename, which lay out their pairs the same way. nothing to substitute leaves src as it is.
+int record_substitution(int opcode, int src_ast_id, const std::vector<int>* pairs)
 {
-    robdd::node_handle false_node = r->get_false();
-    robdd::node_handle true_node = r->get_true();
+    if (pairs->empty())
+        return src_ast_id;
 
-    FILE* f = fopen(fn, "w");
-    
-    if (!f)
-    {
-        printf("failed to open %s\n", fn);
-    }
+    int ast_id = g_next_ast_id;
+    g_next_ast_id += 1;
 
-    fprintf(f, "digraph {\n");
+    bdd_instr instr;
+    instr.opcode = opcode;
+    instr.operand_compose_dst_id = ast_id;
+    instr.operand_compose_src_id = src_ast_id;
+    instr.operand_compose_pairs = pairs;
+    g_bdd_instructions.push_back(instr);
 
-    fprintf(f, "  labelloc=\"t\";\n");
-    fprintf(f, "  label=\"%s\";\n", title);
+    return ast_id;
+}
 
-    std::vector<robdd::node_handle> nodes2add;
-    nodes2add.insert(nodes2add.end(), roots, roots + num_roots);
+int l_compose(lua_State* L)
+{
+    int src_ast_id = arg_to_ast(L, 1);
+    return push_ast(L, record_substitution(bdd_instr::opcode_compose, src_ast_id, arg_to_substitution_pairs(L, 2, false)));
+}
 
-    std::unordered_set<robdd::node_handle> added;
-    added.insert(false_node);
-    added.insert(true_node);
+int l_rename(lua_State* L)
+{
+    int src_ast_id = arg_to_ast(L, 1);
+    return push_ast(L, record_substitution(bdd_instr::opcode_rename, src_ast_id, arg_to_substitution_pairs(L, 2, true)));
+}
 
-    std::unordered_set<robdd::node_handle> declared;
+// reads a forest that save_bdd wrote. its variables become inputs like the script's own, shared by name,
+// and its roots are returned in a table by name.
+int l_load_bdd(lua_State* L)
+{
+    const char* fn = luaL_checkstring(L, 1);
 
-    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    g_loaded_forests.emplace_back();
+    bdd_forest& forest = g_loaded_forests.back();
+    if (!load_forest(fn, forest))
     {
-        if (declared.find(roots[root_idx]) != end(declared))
-        {
-            continue;
-        }
-
-        if (roots[root_idx] == false_node)
-        {
-            fprintf(f, "  n%x [label=\"0\",shape=box];\n", false_node);
-        }
-        else if (roots[root_idx] == true_node)
-        {
-            fprintf(f, "  n%x [label=\"1\",shape=box];\n", true_node);
-        }
-        else
-        {
-            fprintf(f, "  n%x [label=\"%s\"];\n", roots[root_idx], g_varid2name.at(r->get_var(roots[root_idx])).c_str());
-        }
-
-        declared.insert(roots[root_idx]);
+        g_loaded_forests.pop_back();
+        luaL_error(L, "failed to load %s", fn);
     }
+    forest.path = fn;
 
-    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    lua_getglobal(L, "input");
+    for (const std::string& name : forest.var_names)
     {
-        fprintf(f, "  r%d [label=\"%s\\n%llu solutions\",style=filled];\n", root_idx, root_names[root_idx].c_str(), r->get_weight(roots[root_idx]));
-        fprintf(f, "  r%d -> n%x [style=solid];\n", root_idx, roots[root_idx]);
+        lua_getfield(L, -1, name.c_str());
+        forest.var_ast_ids.push_back(arg_to_ast(L, -1));
+        lua_pop(L, 1);
     }
+    lua_pop(L, 1);
 
-    while (!nodes2add.empty())
+    lua_newtable(L);
+    for (int root_idx = 0; root_idx < (int)forest.root_names.size(); root_idx++)
     {
-        robdd::node_handle n = nodes2add.back();
-        nodes2add.pop_back();
-
-        if (added.find(n) != added.end())
-            continue;
-
-        const robdd::node_handle children[] = { r->get_lo(n), r->get_hi(n) };
-        for (robdd::node_handle child : children)
-        {
-            if (declared.insert(child).second)
-            {
-                if (child == false_node)
-                {
-                    fprintf(f, "  n%x [label=\"0\",shape=box];\n", false_node);
-                }
-                else if (child == true_node)
-                {
-                    fprintf(f, "  n%x [label=\"1\",shape=box];\n", true_node);
-                }
-                else
-                {
-                    fprintf(f, "  n%x [label=\"%s\"];\n", child, g_varid2name.at(r->get_var(child)).c_str());
-                }
-            }
-
-            fprintf(f, "  n%x -> n%x [style=%s];\n", n, child, child == r->get_lo(n) ? "dotted" : "solid");
-
-            if (added.find(child) == added.end())
-                nodes2add.push_back(child);
-        }
-
-        added.insert(n);
+        int ast_id = g_next_ast_id;
+        g_next_ast_id += 1;
+
+        bdd_instr load_instr;
+        load_instr.opcode = bdd_instr::opcode_load;
+        load_instr.operand_load_dst_id = ast_id;
+        load_instr.operand_load_root_idx = root_idx;
+        load_instr.operand_load_forest = &forest;
+        g_bdd_instructions.push_back(load_instr);
+
+        push_ast(L, ast_id);
+        lua_setfield(L, -2, forest.root_names[root_idx].c_str());
     }
 
-    fprintf(f, "}\n");
+    return 1;
+}
 
-    fclose(f);
+// the bdd built for an output, given as its ast or its name in the output table
+robdd::node_handle arg_to_built_root(lua_State* L, int argidx)
+{
+    if (!g_built_bdd)
+        luaL_error(L, "Outputs can only be queried from after_build");
 
-    std::string dotcmd = std::string("packages\\Graphviz.2.38.0.2\\dot.exe") + " -Tpng " + fn + " -o " + fn + ".png";
-    if (system(dotcmd.c_str()) == 0)
+    int ast_id;
+    if (lua_type(L, argidx) == LUA_TSTRING)
     {
-        std::string pngcmd = std::string(fn) + ".png";
-        system(pngcmd.c_str());
+        lua_getglobal(L, "output");
+        lua_getfield(L, -1, lua_tostring(L, argidx));
+        ast_id = arg_to_ast(L, -1);
+        lua_pop(L, 2);
+    }
+    else
+    {
+        ast_id = arg_to_ast(L, argidx);
     }
-}
 
-std::vector<bdd_instr> g_bdd_instructions;
-int g_next_ast_id = ast_id_user;
-int g_num_variables = 0;
+    auto root = g_built_roots.find(ast_id);
+    if (root == g_built_roots.end())
+        luaL_error(L, "Only outputs can be queried");
 
-int l_input_newindex(lua_State* L)
-{
-    luaL_error(L, "Cannot write to inputs table");
-    return 0;
+    return root->second;
 }
 
-int l_input_index(lua_State* L)
+// weighted_count(f, weights): the total weight of f's solutions. weights maps input names to the
+// probability of the input being true, or to a pair {false weight, true weight}. other inputs weigh 1 either way.
+int l_weighted_count(lua_State* L)
 {
-    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
-    *ast_id = g_next_ast_id;
-    g_next_ast_id += 1;
+    robdd::node_handle root = arg_to_built_root(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
 
-    auto varid2name = g_varid2name.emplace(g_num_variables, luaL_checkstring(L, 2)).first;
-    
-    g_num_variables += 1;
+    std::unordered_map<std::string, int> name2varid;
+    for (const auto& e : g_varid2name)
+    {
+        name2varid.emplace(e.second, e.first);
+    }
 
-    bdd_instr new_instr;
-    new_instr.opcode = bdd_instr::opcode_newinput;
-    new_instr.operand_newinput_ast_id = *ast_id;
-    new_instr.operand_newinput_var_id = varid2name->first;
-    new_instr.operand_newinput_name = &varid2name->second;
-    g_bdd_instructions.push_back(new_instr);
+    std::vector<double> false_weights(g_num_variables, 1.0);
+    std::vector<double> true_weights(g_num_variables, 1.0);
 
-    luaL_newmetatable(L, "ast");
-    lua_setmetatable(L, -2);
+    lua_pushnil(L);
+    while (lua_next(L, 2))
+    {
+        // converting the key itself would confuse lua_next, and input[1] is named "1"
+        lua_pushvalue(L, -2);
+        const char* name = lua_tostring(L, -1);
+        if (!name)
+            luaL_error(L, "Inputs are named by strings or numbers");
+        auto var = name2varid.find(name);
+        if (var == name2varid.end())
+            luaL_error(L, "No input named %s", name);
+        lua_pop(L, 1);
+
+        if (lua_istable(L, -1))
+        {
+            lua_rawgeti(L, -1, 1);
+            lua_rawgeti(L, -2, 2);
+            false_weights[var->second] = luaL_checknumber(L, -2);
+            true_weights[var->second] = luaL_checknumber(L, -1);
+            lua_pop(L, 2);
+        }
+        else
+        {
+            double p = luaL_checknumber(L, -1);
+            false_weights[var->second] = 1.0 - p;
+            true_weights[var->second] = p;
+        }
 
-    lua_pushvalue(L, -2);
-    lua_pushvalue(L, -2);
-    lua_rawset(L, -5);
+        lua_pop(L, 1);
+    }
 
+    lua_pushnumber(L, g_built_bdd->weighted_count(1, &root, false_weights.data(), true_weights.data())[0]);
     return 1;
 }
 
-int arg_to_ast(lua_State* L, int argidx)
-{
-    if (lua_isboolean(L, argidx))
-        return lua_toboolean(L, argidx) ? ast_id_true : ast_id_false;
-    else
-        return *(int*)luaL_checkudata(L, argidx, "ast");
-}
-
-int l_and(lua_State* L)
+// sample(f, n, filename[, seed]): writes n uniformly random solutions of f to filename, each packed into
+// one bit per input in (number of inputs + 7) / 8 bytes. returns false if f has no solutions.
+int l_sample(lua_State* L)
 {
-    int ast1_id = arg_to_ast(L, 1);
-    int ast2_id = arg_to_ast(L, 2);
+    robdd::node_handle root = arg_to_built_root(L, 1);
+    uint64_t num_samples = (uint64_t)luaL_checknumber(L, 2);
+    const char* fn = luaL_checkstring(L, 3);
+    uint64_t seed = (uint64_t)luaL_optnumber(L, 4, 0);
 
-    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
-    *ast_id = g_next_ast_id;
-    g_next_ast_id += 1;
+    FILE* f = fopen(fn, "wb");
+    if (!f)
+        luaL_error(L, "failed to open %s", fn);
 
-    bdd_instr and_instr;
-    and_instr.opcode = bdd_instr::opcode_and;
-    and_instr.operand_and_dst_id = *ast_id;
-    and_instr.operand_and_src1_id = ast1_id;
-    and_instr.operand_and_src2_id = ast2_id;
-    g_bdd_instructions.push_back(and_instr);
+    bool sampled = g_built_bdd->sample(root, num_samples, seed, [&](const uint8_t* data, size_t size) {
+        fwrite(data, 1, size, f);
+    });
 
-    luaL_newmetatable(L, "ast");
-    lua_setmetatable(L, -2);
+    fclose(f);
 
+    lua_pushboolean(L, sampled);
     return 1;
 }
 
-int l_or(lua_State* L)
+// enumerate(f, filename[, format]): writes every solution of f to filename, in no particular order.
+// the formats are "cubes" (the default), "assignments", "binary cubes" and "binary assignments".
+// returns how many were written.
+int l_enumerate(lua_State* L)
 {
-    int ast1_id = arg_to_ast(L, 1);
-    int ast2_id = arg_to_ast(L, 2);
+    static const char* const formats[] = { "cubes", "assignments", "binary cubes", "binary assignments", nullptr };
+    static const int format_ids[] = {
+        robdd::solution_format::text_cubes,
+        robdd::solution_format::text_assignments,
+        robdd::solution_format::binary_cubes,
+        robdd::solution_format::binary_assignments
+    };
 
-    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
-    *ast_id = g_next_ast_id;
-    g_next_ast_id += 1;
+    robdd::node_handle root = arg_to_built_root(L, 1);
+    const char* fn = luaL_checkstring(L, 2);
+    int format = format_ids[luaL_checkoption(L, 3, "cubes", formats)];
 
-    bdd_instr or_instr;
-    or_instr.opcode = bdd_instr::opcode_or;
-    or_instr.operand_or_dst_id = *ast_id;
-    or_instr.operand_or_src1_id = ast1_id;
-    or_instr.operand_or_src2_id = ast2_id;
-    g_bdd_instructions.push_back(or_instr);
+    FILE* f = fopen(fn, "wb");
+    if (!f)
+        luaL_error(L, "failed to open %s", fn);
 
-    luaL_newmetatable(L, "ast");
-    lua_setmetatable(L, -2);
+    uint64_t num_written = g_built_bdd->enumerate(root, format, [&](const char* data, size_t size) {
+        fwrite(data, 1, size, f);
+    });
+
+    fclose(f);
 
+    lua_pushnumber(L, (lua_Number)num_written);
     return 1;
 }
 
-int l_xor(lua_State* L)
+// writes outputs to a file that load_bdd can read, given by name or as asts after the filename, or all of them
+int l_save_bdd(lua_State* L)
 {
-    int ast1_id = arg_to_ast(L, 1);
-    int ast2_id = arg_to_ast(L, 2);
+    const char* fn = luaL_checkstring(L, 1);
+    if (!g_built_bdd)
+        luaL_error(L, "Outputs can only be saved from after_build");
+
+    std::vector<robdd::node_handle> roots;
+    std::vector<std::string> root_names;
+    lua_getglobal(L, "output");
+    int output_idx = lua_gettop(L);
+    lua_pushnil(L);
+    while (lua_next(L, output_idx))
+    {
+        // an output is saved if no outputs were given, or if it was given by name or by its ast
+        bool wanted = output_idx == 2;
+        for (int argidx = 2; argidx < output_idx && !wanted; argidx++)
+        {
+            wanted = lua_type(L, argidx) == LUA_TSTRING ? lua_equal(L, argidx, -2) != 0 : arg_to_ast(L, argidx) == arg_to_ast(L, -1);
+        }
 
-    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
-    *ast_id = g_next_ast_id;
-    g_next_ast_id += 1;
+        if (wanted)
+        {
+            roots.push_back(arg_to_built_root(L, -1));
+            lua_pushvalue(L, -2);
+            root_names.push_back(lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
 
-    bdd_instr xor_instr;
-    xor_instr.opcode = bdd_instr::opcode_xor;
-    xor_instr.operand_xor_dst_id = *ast_id;
-    xor_instr.operand_xor_src1_id = ast1_id;
-    xor_instr.operand_xor_src2_id = ast2_id;
-    g_bdd_instructions.push_back(xor_instr);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
 
-    luaL_newmetatable(L, "ast");
-    lua_setmetatable(L, -2);
+    if (!save_forest(g_built_bdd, (int)roots.size(), roots.data(), root_names.data(), g_varid2name, fn))
+        luaL_error(L, "failed to write %s", fn);
 
+    lua_pushnumber(L, (lua_Number)roots.size());
     return 1;
 }
 
-int l_not(lua_State* L)
+// calls the script's after_build function, if it has one, with the outputs open to queries
+void call_after_build(lua_State* L, robdd* r, int num_roots, const int* root_ast_ids, const robdd::node_handle* roots)
 {
-    int ast_id_in = arg_to_ast(L, 1);
+    lua_getglobal(L, "after_build");
+    if (!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        return;
+    }
 
-    int* ast_id = (int*)lua_newuserdata(L, sizeof(int));
-    *ast_id = g_next_ast_id;
-    g_next_ast_id += 1;
+    g_built_bdd = r;
+    for (int root_idx = 0; root_idx < num_roots; root_idx++)
+    {
+        g_built_roots[root_ast_ids[root_idx]] = roots[root_idx];
+    }
 
-    bdd_instr not_instr;
-    not_instr.opcode = bdd_instr::opcode_not;
-    not_instr.operand_not_dst_id = *ast_id;
-    not_instr.operand_not_src_id = ast_id_in;
-    g_bdd_instructions.push_back(not_instr);
+    if (lua_pcall(L, 0, 0, 0))
+    {
+        printf("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
 
-    luaL_newmetatable(L, "ast");
-    lua_setmetatable(L, -2);
+    g_built_bdd = nullptr;
+    g_built_roots.clear();
+}
 
-    return 1;
+// drops every instruction that no root depends on, so decode doesn't spend time or nodes on it
+void prune_to_cone(const std::vector<int>& root_ast_ids)
+{
+    instr_graph graph((int)g_bdd_instructions.size(), g_bdd_instructions.data(), g_next_ast_id - ast_id_user, g_num_variables);
+    std::vector<bool> in_cone = graph.get_cone((int)root_ast_ids.size(), root_ast_ids.data());
+
+    size_t num_kept = 0;
+    for (size_t i = 0; i < g_bdd_instructions.size(); i++)
+    {
+        if (in_cone[i])
+        {
+            g_bdd_instructions[num_kept++] = g_bdd_instructions[i];
+        }
+    }
+    g_bdd_instructions.resize(num_kept);
 }
 
-int main(int argc, char* argv[])
+// renumbers the inputs so that var id i is order[i], which makes it the i-th variable from the top
+void apply_var_order(const std::vector<int>& order)
 {
-    if (argc < 2)
+    std::vector<int> new_var_id(order.size());
+    for (int i = 0; i < (int)order.size(); i++)
     {
-        printf("Usage: %s <input file> [output file]\n", argc >= 1 ? argv[0] : "robdd");
-        return 0;
+        new_var_id[order[i]] = i;
     }
 
-    const char* infile = argv[1];
+    std::map<int, std::string> varid2name;
+    for (auto& e : g_varid2name)
+    {
+        varid2name.emplace(new_var_id[e.first], std::move(e.second));
+    }
+    g_varid2name.swap(varid2name);
 
-    std::string default_outfile = std::string(argv[1]) + ".dot";
-    const char* outfile = argc >= 3 ? argv[2] : default_outfile.c_str();
+    for (bdd_instr& inst : g_bdd_instructions)
+    {
+        if (inst.opcode == bdd_instr::opcode_newinput)
+        {
+            inst.operand_newinput_var_id = new_var_id[inst.operand_newinput_var_id];
+            inst.operand_newinput_name = &g_varid2name.at(inst.operand_newinput_var_id);
+        }
+    }
+}
 
-    lua_State* L = luaL_newstate();
+// runs a script, which records its instructions, and reads what it put in the output table
+bool run_script(lua_State* L, const char* infile, std::vector<int>& root_ast_ids, std::vector<std::string>& root_ast_names)
+{
     luaL_openlibs(L);
 
     luaL_newmetatable(L, "ast");
@@ -1222,14 +5511,60 @@ int main(int argc, char* argv[])
     lua_newtable(L);
     lua_setglobal(L, "output");
 
+    lua_pushcfunction(L, l_ite);
+    lua_setglobal(L, "ite");
+
+    lua_pushcfunction(L, l_and_all);
+    lua_setglobal(L, "and_all");
+
+    lua_pushcfunction(L, l_or_all);
+    lua_setglobal(L, "or_all");
+
+    lua_pushcfunction(L, l_exists);
+    lua_setglobal(L, "exists");
+
+    lua_pushcfunction(L, l_forall);
+    lua_setglobal(L, "forall");
+
+    lua_pushcfunction(L, l_and_exists);
+    lua_setglobal(L, "and_exists");
+
+    lua_pushcfunction(L, l_restrict);
+    lua_setglobal(L, "restrict");
+
+    lua_pushcfunction(L, l_constrain);
+    lua_setglobal(L, "constrain");
+
+    lua_pushcfunction(L, l_cofactor);
+    lua_setglobal(L, "cofactor");
+
+    lua_pushcfunction(L, l_compose);
+    lua_setglobal(L, "compose");
+
+    lua_pushcfunction(L, l_rename);
+    lua_setglobal(L, "rename");
+
+    lua_pushcfunction(L, l_load_bdd);
+    lua_setglobal(L, "load_bdd");
+
+    lua_pushcfunction(L, l_weighted_count);
+    lua_setglobal(L, "weighted_count");
+
+    lua_pushcfunction(L, l_sample);
+    lua_setglobal(L, "sample");
+
+    lua_pushcfunction(L, l_enumerate);
+    lua_setglobal(L, "enumerate");
+
+    lua_pushcfunction(L, l_save_bdd);
+    lua_setglobal(L, "save_bdd");
+
     if (luaL_dofile(L, infile))
     {
         printf("%s\n", lua_tostring(L, -1));
-        return 1;
+        return false;
     }
 
-    std::vector<int> root_ast_ids;
-    std::vector<std::string> root_ast_names;
     {
         auto read_results = [](lua_State* L)
         {
@@ -1272,97 +5607,722 @@ int main(int argc, char* argv[])
         if (lua_pcall(L, 2, 0, 0))
         {
             printf("%s\n", lua_tostring(L, -1));
-            return 1;
+            return false;
         }
     }
 
-    lua_getglobal(L, "title");
-    const char* title = lua_isstring(L, -1) ? lua_tostring(L, -1) : infile;
-    lua_pop(L, 1);
+    return true;
+}
 
-    lua_getglobal(L, "display");
-    bool display = lua_isboolean(L, -1) ? lua_toboolean(L, -1) != 0: false;
-    lua_pop(L, 1);
+// traces hold what decode needs to build a script's outputs again without running it: the instructions as they
+// are after pruning and ordering, the roots and the script's settings. after the header everything is varints,
+// with strings as a length and their bytes: the title, display, reorder, the name of every variable, every
+// forest that's still loaded from as its path and the inputs of its levels, every root as its ast id and name,
+// and the instructions. an instruction is its opcode and its int operands, followed by the pairs of a compose
+// or rename, or the forest of a load. forests are only referred to, so their files have to stay where they were.
+// the user ast ids are renumbered in the order of the instructions that define them, so there are as many as
+// there are instructions.
+static const char trace_magic[8] = { 'r', 'o', 'b', 'd', 'd', 't', 'r', '1' };
+
+struct trace_header
+{
+    char magic[8];
+    uint32_t num_vars;
+    uint32_t num_user_ast_nodes;
+    uint64_t num_instrs;
+    uint32_t num_roots;
+    uint32_t num_forests;
+    uint64_t body_size;
+};
 
-    int max_threads = tbb::task_scheduler_init::default_num_threads();
-    
-    int initial_num_threads = max_threads;
-#ifdef BENCHMARK
-    initial_num_threads = 0;
-#endif
+// how many ints each kind of instruction starts with. they line up in every one of the union's structs.
+int num_int_operands(int opcode)
+{
+    switch (opcode)
+    {
+    case bdd_instr::opcode_not:
+    case bdd_instr::opcode_newinput:
+    case bdd_instr::opcode_compose:
+    case bdd_instr::opcode_rename:
+    case bdd_instr::opcode_load:
+        return 2;
+    case bdd_instr::opcode_ite:
+    case bdd_instr::opcode_and_exists:
+        return 4;
+    default:
+        return 3;
+    }
+}
+
+void put_string(std::string& out, const std::string& str)
+{
+    put_varint(out, str.size());
+    out += str;
+}
+
+bool write_trace(
+    const char* fn,
+    const std::string& title, bool display, bool reorder,
+    const std::vector<int>& root_ast_ids, const std::vector<std::string>& root_ast_names)
+{
+    // pruning leaves gaps in the ast ids, which a reader would otherwise have to make room for
+    std::vector<int> new_ast_id(g_next_ast_id, -1);
+    for (int ast_id = 0; ast_id < ast_id_user; ast_id++)
+        new_ast_id[ast_id] = ast_id;
+    for (size_t i = 0; i < g_bdd_instructions.size(); i++)
+        new_ast_id[get_dst_ast_id(g_bdd_instructions[i])] = ast_id_user + (int)i;
+
+    std::string body;
+    put_string(body, title);
+    put_varint(body, display ? 1 : 0);
+    put_varint(body, reorder ? 1 : 0);
+
+    // pruning may have dropped the instructions of some inputs, so the names are kept apart from them
+    for (const auto& e : g_varid2name)
+        put_string(body, e.second);
+
+    // a load reads the inputs of its forest, so those are left whenever the forest is still loaded from
+    std::unordered_map<const bdd_forest*, uint64_t> forest_idx;
+    for (const bdd_instr& inst : g_bdd_instructions)
+    {
+        if (inst.opcode != bdd_instr::opcode_load || !forest_idx.emplace(inst.operand_load_forest, forest_idx.size()).second)
+            continue;
+
+        const bdd_forest& forest = *inst.operand_load_forest;
+        put_string(body, forest.path);
+        put_varint(body, forest.var_ast_ids.size());
+        for (int ast_id : forest.var_ast_ids)
+            put_varint(body, new_ast_id[ast_id]);
+    }
+
+    for (size_t root_idx = 0; root_idx < root_ast_ids.size(); root_idx++)
+    {
+        put_varint(body, new_ast_id[root_ast_ids[root_idx]]);
+        put_string(body, root_ast_names[root_idx]);
+    }
+
+    for (const bdd_instr& inst : g_bdd_instructions)
+    {
+        put_varint(body, inst.opcode);
+
+        // the second int of a new input is its variable and that of a load is which root
+        const int* operands = &inst.operand_dontcare_dst_id;
+        bool second_is_ast_id = inst.opcode != bdd_instr::opcode_newinput && inst.opcode != bdd_instr::opcode_load;
+        for (int i = 0; i < num_int_operands(inst.opcode); i++)
+            put_varint(body, i != 1 || second_is_ast_id ? new_ast_id[operands[i]] : operands[i]);
+
+        switch (inst.opcode)
+        {
+        // rename's pairs sit where compose's do
+        case bdd_instr::opcode_compose:
+        case bdd_instr::opcode_rename:
+            put_varint(body, inst.operand_compose_pairs->size());
+            for (int ast_id : *inst.operand_compose_pairs)
+                put_varint(body, new_ast_id[ast_id]);
+            break;
+        case bdd_instr::opcode_load:
+            put_varint(body, forest_idx.at(inst.operand_load_forest));
+            break;
+        }
+    }
+
+    trace_header header;
+    memcpy(header.magic, trace_magic, sizeof(header.magic));
+    header.num_vars = (uint32_t)g_num_variables;
+    header.num_user_ast_nodes = (uint32_t)g_bdd_instructions.size();
+    header.num_instrs = g_bdd_instructions.size();
+    header.num_roots = (uint32_t)root_ast_ids.size();
+    header.num_forests = (uint32_t)forest_idx.size();
+    header.body_size = body.size();
+
+    FILE* f = fopen(fn, "wb");
+    if (!f)
+        return false;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(body.data(), 1, body.size(), f);
+
+    bool ok = ferror(f) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+bool is_trace(const char* fn)
+{
+    FILE* f = fopen(fn, "rb");
+    if (!f)
+        return false;
 
-    for (int num_threads = initial_num_threads; num_threads <= max_threads; num_threads++)
+    char magic[sizeof(trace_magic)];
+    bool matches = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, trace_magic, sizeof(magic)) == 0;
+    fclose(f);
+    return matches;
+}
+
+// fills in the instructions, variables and loaded forests as the script that was traced left them.
+// false if the trace or one of its forests can't be read, or doesn't hang together.
+bool read_trace(
+    const char* fn,
+    std::string& title, bool& display, bool& reorder,
+    std::vector<int>& root_ast_ids, std::vector<std::string>& root_ast_names)
+{
+    mapped_file file(fn);
+    const uint8_t* p = file.data();
+
+    trace_header header;
+    if (file.size() < sizeof(header))
+        return false;
+    memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+
+    if (memcmp(header.magic, trace_magic, sizeof(header.magic)) != 0 || file.size() - sizeof(header) < header.body_size)
+        return false;
+    // every root and instruction takes a byte at least, and every user ast node is defined by an instruction
+    if (header.num_roots > header.body_size || header.num_instrs > header.body_size || header.num_user_ast_nodes != header.num_instrs)
+        return false;
+    const uint8_t* end = p + header.body_size;
+
+    g_num_variables = (int)header.num_vars;
+    g_next_ast_id = ast_id_user + (int)header.num_user_ast_nodes;
+
+    auto get_int = [&](int& value, int bound) {
+        uint64_t v;
+        if (!get_varint(p, end, v) || v >= (uint64_t)bound)
+            return false;
+        value = (int)v;
+        return true;
+    };
+    auto get_string = [&](std::string& str) {
+        uint64_t length;
+        if (!get_varint(p, end, length) || length > (uint64_t)(end - p))
+            return false;
+        str.assign((const char*)p, (size_t)length);
+        p += length;
+        return true;
+    };
+
+    int flag;
+    if (!get_string(title) || !get_int(flag, 2))
+        return false;
+    display = flag != 0;
+    if (!get_int(flag, 2))
+        return false;
+    reorder = flag != 0;
+
+    for (int var = 0; var < g_num_variables; var++)
+    {
+        if (!get_string(g_varid2name[var]))
+            return false;
+    }
+
+    std::vector<bdd_forest*> forests;
+    for (uint32_t i = 0; i < header.num_forests; i++)
+    {
+        g_loaded_forests.emplace_back();
+        bdd_forest& forest = g_loaded_forests.back();
+        forests.push_back(&forest);
+
+        int num_var_ast_ids;
+        if (!get_string(forest.path) || !load_forest(forest.path.c_str(), forest) || !get_int(num_var_ast_ids, INT_MAX))
+            return false;
+        if (num_var_ast_ids != (int)forest.var_names.size())
+            return false;
+
+        forest.var_ast_ids.resize(num_var_ast_ids);
+        for (int& ast_id : forest.var_ast_ids)
+        {
+            if (!get_int(ast_id, g_next_ast_id))
+                return false;
+        }
+    }
+
+    root_ast_ids.resize(header.num_roots);
+    root_ast_names.resize(header.num_roots);
+    for (uint32_t root_idx = 0; root_idx < header.num_roots; root_idx++)
     {
-        robdd bdd(g_num_variables, num_threads == 0 ? -1 : num_threads);
-        std::vector<robdd::node_handle> roots(root_ast_ids.size());
+        if (!get_int(root_ast_ids[root_idx], g_next_ast_id) || !get_string(root_ast_names[root_idx]))
+            return false;
+    }
+
+    g_bdd_instructions.resize((size_t)header.num_instrs);
+    for (bdd_instr& inst : g_bdd_instructions)
+    {
+        if (!get_int(inst.opcode, bdd_instr::opcode_load + 1))
+            return false;
+
+        // the second int of a new input is its variable and that of a load is which root
+        int* operands = &inst.operand_dontcare_dst_id;
+        for (int i = 0; i < num_int_operands(inst.opcode); i++)
+        {
+            if (!get_int(operands[i], g_next_ast_id))
+                return false;
+        }
+
+        switch (inst.opcode)
+        {
+        case bdd_instr::opcode_newinput:
+            if (inst.operand_newinput_var_id >= g_num_variables)
+                return false;
+            inst.operand_newinput_name = &g_varid2name.at(inst.operand_newinput_var_id);
+            break;
+        case bdd_instr::opcode_compose:
+        case bdd_instr::opcode_rename:
+        {
+            // every ast id of a pair takes a byte at least
+            int num_pairs;
+            if (!get_int(num_pairs, (int)std::min<ptrdiff_t>(end - p, INT_MAX - 1) + 1))
+                return false;
 
-#ifndef BENCHMARK
-        if (num_threads != 0)
+            g_substitution_pairs.emplace_back(num_pairs);
+            for (int& ast_id : g_substitution_pairs.back())
+            {
+                if (!get_int(ast_id, g_next_ast_id))
+                    return false;
+            }
+            inst.operand_compose_pairs = &g_substitution_pairs.back();
+            break;
+        }
+        case bdd_instr::opcode_load:
         {
-            printf("decoding with %d threads...\n", num_threads);
+            int forest_idx;
+            if (!get_int(forest_idx, (int)forests.size()))
+                return false;
+            inst.operand_load_forest = forests[forest_idx];
+            if (inst.operand_load_root_idx >= (int)inst.operand_load_forest->root_names.size())
+                return false;
+            break;
+        }
         }
+    }
+
+    return true;
+}
+
+// --pin keeps every thread that joins the arena on the core of its slot, so timings don't depend on
+// where the scheduler of the OS moves them. a no-op other than on Linux. it only sees threads of the
+// arena it was made for, so it starts observing once the arena is initialized.
+class thread_pinner : public tbb::task_scheduler_observer
+{
+public:
+    explicit thread_pinner(tbb::task_arena& arena)
+        : tbb::task_scheduler_observer(arena)
+    {
+    }
+
+    ~thread_pinner()
+    {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) override
+    {
+#ifdef __linux__
+        int num_cpus = (int)std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(tbb::this_task_arena::current_thread_index() % num_cpus, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
 #endif
+    }
+};
+
+struct run_stats
+{
+    double min;
+    double median;
+    double mean;
+    // of the sample, so 0 for a single run
+    double stddev;
+};
 
-        // num_threads == 0 does a warmup run to attempt to nullify cache effects that penalize the first run
-        tbb::task_scheduler_init scheduler_init(num_threads == 0 ? -1 : num_threads);
+run_stats summarize_runs(std::vector<double> secs)
+{
+    std::sort(secs.begin(), secs.end());
+    size_t n = secs.size();
 
-        LARGE_INTEGER now, then, freq;
-        QueryPerformanceFrequency(&freq);
+    run_stats stats;
+    stats.min = secs[0];
+    stats.median = n % 2 != 0 ? secs[n / 2] : (secs[n / 2 - 1] + secs[n / 2]) / 2;
 
-        QueryPerformanceCounter(&then);
+    double sum = 0;
+    for (double s : secs)
+        sum += s;
+    stats.mean = sum / n;
 
-        decode(
-            (int)g_bdd_instructions.size(), g_bdd_instructions.data(),
-            g_next_ast_id - ast_id_user, // num user ast nodes
-            (int)root_ast_ids.size(), root_ast_ids.data(),
-            &bdd,
-            roots.data());
+    double squares = 0;
+    for (double s : secs)
+        squares += (s - stats.mean) * (s - stats.mean);
+    stats.stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
 
-        QueryPerformanceCounter(&now);
+    return stats;
+}
 
-        if (num_threads == 0)
+int main(int argc, char* argv[])
+{
+    int order = var_order::declared;
+    size_t cache_mb = 0;
+    const char* record_fn = nullptr;
+    std::vector<int> thread_counts;
+    bool apply_tasks = false;
+    bool benchmark = false;
+    int num_runs = 5;
+    bool json = false;
+    bool pin = false;
+
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--order=") == 0)
         {
-            continue;
+            std::string name = arg.substr(8);
+            if (name == "declared")
+                order = var_order::declared;
+            else if (name == "dfs")
+                order = var_order::dfs;
+            else if (name == "interleave")
+                order = var_order::interleave;
+            else if (name == "force")
+                order = var_order::force;
+            else
+            {
+                printf("unknown variable order %s\n", name.c_str());
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 11, "--cache-mb=") == 0)
+        {
+            cache_mb = strtoul(arg.c_str() + 11, nullptr, 10);
+        }
+        else if (arg.compare(0, 9, "--record=") == 0)
+        {
+            record_fn = argv[i] + 9;
+        }
+        else if (arg.compare(0, 10, "--threads=") == 0)
+        {
+            // a list like 1,2,4,8
+            for (const char* p = arg.c_str() + 10; *p; p += *p == ',')
+            {
+                char* next;
+                long num_threads = strtol(p, &next, 10);
+                if (next == p || num_threads < 1 || (*next != ',' && *next != '\0'))
+                {
+                    printf("bad thread counts %s\n", arg.c_str() + 10);
+                    return 1;
+                }
+                thread_counts.push_back((int)num_threads);
+                p = next;
+            }
+        }
+        else if (arg.compare(0, 8, "--apply=") == 0)
+        {
+            std::string name = arg.substr(8);
+            if (name == "group")
+                apply_tasks = false;
+            else if (name == "task")
+                apply_tasks = true;
+            else
+            {
+                printf("unknown apply %s\n", name.c_str());
+                return 1;
+            }
+#ifndef HAVE_APPLY_TASK
+            if (apply_tasks)
+            {
+                printf("--apply=task needs a TBB with the tbb::task API\n");
+                return 1;
+            }
+#endif
+        }
+        else if (arg == "--show-instrs")
+        {
+            g_show_instrs = true;
+        }
+        else if (arg == "--benchmark")
+        {
+            benchmark = true;
+        }
+        else if (arg.compare(0, 9, "--repeat=") == 0)
+        {
+            num_runs = std::max(1, atoi(arg.c_str() + 9));
+        }
+        else if (arg.compare(0, 9, "--format=") == 0)
+        {
+            std::string name = arg.substr(9);
+            if (name == "csv")
+                json = false;
+            else if (name == "json")
+                json = true;
+            else
+            {
+                printf("unknown format %s\n", name.c_str());
+                return 1;
+            }
+        }
+        else if (arg == "--pin")
+        {
+            pin = true;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+
+    if (args.size() < 1)
+    {
+        printf("Usage: %s [options] <script or trace file> [output file]\n", argc >= 1 ? argv[0] : "robdd");
+        printf("  --order=declared|dfs|interleave|force  initial variable order\n");
+        printf("  --cache-mb=<n>                          computed table budget\n");
+        printf("  --record=<trace file>                   save what decode runs, to replay without the script\n");
+        printf("  --threads=<n>[,<n>...]                  threads to decode with, all of them by default\n");
+        printf("  --apply=group|task                      task_group recursion, or tbb::task continuations\n");
+        printf("  --show-instrs                           print every instruction as it's decoded\n");
+        printf("  --benchmark                             time decode instead of reporting solutions\n");
+        printf("  --repeat=<n>                            timed runs per thread count, after a warmup\n");
+        printf("  --format=csv|json                       how the benchmark reports\n");
+        printf("  --pin                                   keep each thread on its own core (Linux)\n");
+        return 0;
+    }
+
+    const char* infile = args[0];
+
+    std::string default_outfile = std::string(infile) + ".dot";
+    const char* outfile = args.size() >= 2 ? args[1] : default_outfile.c_str();
+
+    std::vector<int> root_ast_ids;
+    std::vector<std::string> root_ast_names;
+    std::string title = infile;
+    bool display = false;
+    bool reorder = false;
+
+    // a trace is decoded as it is, with no script to run and so no after_build
+    lua_State* L = nullptr;
+    if (is_trace(infile))
+    {
+        if (!read_trace(infile, title, display, reorder, root_ast_ids, root_ast_names))
+        {
+            printf("failed to read trace %s\n", infile);
+            return 1;
+        }
+    }
+    else
+    {
+        L = luaL_newstate();
+        if (!run_script(L, infile, root_ast_ids, root_ast_names))
+        {
+            return 1;
         }
 
-        UINT64 seconds = (now.QuadPart - then.QuadPart) / freq.QuadPart;
-        UINT64 milliseconds = (now.QuadPart - then.QuadPart) * 1000 / freq.QuadPart;
-        UINT64 microseconds = (now.QuadPart - then.QuadPart) * 1000000 / freq.QuadPart;
+        lua_getglobal(L, "title");
+        if (lua_isstring(L, -1))
+            title = lua_tostring(L, -1);
+        lua_pop(L, 1);
 
-#ifdef BENCHMARK
-        printf("%d, %.3lf\n", num_threads, double(now.QuadPart - then.QuadPart) / freq.QuadPart);
-#else
-        if (seconds > 0)
+        lua_getglobal(L, "display");
+        display = lua_isboolean(L, -1) ? lua_toboolean(L, -1) != 0 : false;
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "reorder");
+        reorder = lua_isboolean(L, -1) ? lua_toboolean(L, -1) != 0 : false;
+        lua_pop(L, 1);
+    }
+
+    prune_to_cone(root_ast_ids);
+
+    if (order != var_order::declared)
+    {
+        instr_graph graph((int)g_bdd_instructions.size(), g_bdd_instructions.data(), g_next_ast_id - ast_id_user, g_num_variables);
+
+        std::vector<int> new_order;
+        switch (order)
+        {
+        case var_order::dfs:
+            new_order = graph.order_dfs((int)root_ast_ids.size(), root_ast_ids.data());
+            break;
+        case var_order::interleave:
+            new_order = graph.order_interleave((int)root_ast_ids.size(), root_ast_ids.data());
+            break;
+        case var_order::force:
+            new_order = graph.order_force((int)root_ast_ids.size(), root_ast_ids.data());
+            break;
+        }
+
+        apply_var_order(new_order);
+    }
+
+    if (record_fn)
+    {
+        if (!write_trace(record_fn, title, display, reorder, root_ast_ids, root_ast_names))
+        {
+            printf("failed to write trace %s\n", record_fn);
+            return 1;
+        }
+    }
+
+    int max_threads = tbb::this_task_arena::max_concurrency();
+    if (thread_counts.empty())
+    {
+        // a benchmark goes through every number of threads, and otherwise they're all used
+        for (int num_threads = benchmark ? 1 : max_threads; num_threads <= max_threads; num_threads++)
+        {
+            thread_counts.push_back(num_threads);
+        }
+    }
+
+    // builds the outputs in bdd on num_threads threads, and gives how many seconds decode took.
+    // returns false if the script's instructions couldn't be decoded.
+    auto build = [&](robdd& bdd, int num_threads, std::vector<robdd::node_handle>& roots, double& elapsed_secs)
+    {
+        bdd.enable_reordering(reorder);
+        if (cache_mb != 0)
+        {
+            bdd.set_computed_table_budget(cache_mb << 20);
+        }
+#ifdef HAVE_APPLY_TASK
+        bdd.enable_apply_tasks(apply_tasks);
+#endif
+        roots.resize(root_ast_ids.size());
+
+        tbb::task_arena arena(num_threads);
+        arena.initialize();
+
+        // made after the arena, so it stops observing before the arena goes away
+        std::unique_ptr<thread_pinner> pinner;
+        if (pin)
+        {
+            pinner.reset(new thread_pinner(arena));
+            pinner->observe(true);
+        }
+
+        auto then = std::chrono::steady_clock::now();
+
+        bool ok = false;
+        arena.execute([&] {
+            ok = decode(
+                (int)g_bdd_instructions.size(), g_bdd_instructions.data(),
+                g_next_ast_id - ast_id_user, // num user ast nodes
+                (int)root_ast_ids.size(), root_ast_ids.data(),
+                &bdd,
+                roots.data());
+        });
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - then;
+        elapsed_secs = elapsed.count();
+        return ok;
+    };
+
+    if (benchmark)
+    {
+        if (json)
+            printf("[\n");
+        else
+            printf("threads,runs,min_secs,median_secs,mean_secs,stddev_secs,peak_nodes\n");
+
+        for (size_t config = 0; config < thread_counts.size(); config++)
+        {
+            int num_threads = thread_counts[config];
+
+            // the first run is a warmup that takes the cache and allocator effects that would penalize it
+            std::vector<double> secs;
+            uint32_t peak_nodes = 0;
+            for (int run = -1; run < num_runs; run++)
+            {
+                robdd bdd(g_num_variables, num_threads);
+                std::vector<robdd::node_handle> roots;
+                double elapsed;
+                if (!build(bdd, num_threads, roots, elapsed))
+                {
+                    return 1;
+                }
+                if (run >= 0)
+                {
+                    secs.push_back(elapsed);
+                    peak_nodes = std::max(peak_nodes, bdd.get_peak_nodes());
+                }
+            }
+
+            run_stats stats = summarize_runs(secs);
+            if (json)
+            {
+                printf("  { \"threads\": %d, \"runs\": %d, \"min_secs\": %.6lf, \"median_secs\": %.6lf, \"mean_secs\": %.6lf, \"stddev_secs\": %.6lf, \"peak_nodes\": %u }%s\n",
+                    num_threads, num_runs, stats.min, stats.median, stats.mean, stats.stddev, peak_nodes, config + 1 < thread_counts.size() ? "," : "");
+            }
+            else
+            {
+                printf("%d,%d,%.6lf,%.6lf,%.6lf,%.6lf,%u\n", num_threads, num_runs, stats.min, stats.median, stats.mean, stats.stddev, peak_nodes);
+            }
+            fflush(stdout);
+        }
+
+        if (json)
+            printf("]\n");
+
+        return 0;
+    }
+
+    for (size_t config = 0; config < thread_counts.size(); config++)
+    {
+        int num_threads = thread_counts[config];
+        bool last = config + 1 == thread_counts.size();
+
+        robdd bdd(g_num_variables, num_threads);
+        std::vector<robdd::node_handle> roots;
+
+        printf("decoding with %d threads...\n", num_threads);
+
+        double elapsed;
+        if (!build(bdd, num_threads, roots, elapsed))
+        {
+            return 1;
+        }
+
+        if (elapsed >= 1.0)
         {
-            printf("Finished in %.3lf seconds\n", double(now.QuadPart - then.QuadPart) / freq.QuadPart);
+            printf("Finished in %.3lf seconds\n", elapsed);
         }
-        else if (milliseconds > 0)
+        else if (elapsed >= 0.001)
         {
-            printf("Finished in %.3lf milliseconds\n", double(now.QuadPart - then.QuadPart) * 1000.0 / freq.QuadPart);
+            printf("Finished in %.3lf milliseconds\n", elapsed * 1000.0);
         }
         else
         {
-            printf("Finished in %.3lf microseconds\n", double(now.QuadPart - then.QuadPart) * 1000000.0 / freq.QuadPart);
+            printf("Finished in %.3lf microseconds\n", elapsed * 1000000.0);
         }
 
+        printf("Peak of %u nodes\n", bdd.get_peak_nodes());
+
+#ifdef PROBE_STATS
+        double buckets_per_lookup, compares_per_lookup;
+        bdd.get_probe_stats(buckets_per_lookup, compares_per_lookup);
+        printf("Unique table scanned %.3lf buckets and compared %.3lf nodes per lookup\n", buckets_per_lookup, compares_per_lookup);
+        printf("Computed table hit %.1lf%% of lookups\n", bdd.get_computed_hit_rate() * 100.0);
+        printf("Ternary computed table hit %.1lf%% of lookups\n", bdd.get_ternary_hit_rate() * 100.0);
+#endif
+
+        std::vector<big_uint> root_counts = bdd.count_solutions((int)roots.size(), roots.data());
+
         for (int root_idx = 0; root_idx < (int)root_ast_ids.size(); root_idx++)
         {
-            printf("Found %llu solutions to \"%s\"\n", bdd.get_weight(roots[root_idx]), root_ast_names[root_idx].c_str());
+            printf("Found %s solutions to \"%s\"\n", root_counts[root_idx].to_string().c_str(), root_ast_names[root_idx].c_str());
         }
 
-        if (num_threads == max_threads)
+        if (last)
         {
             if (display)
             {
                 printf("writing dot file...\n");
 
                 write_dot(
-                    title,
-                    (int)roots.size(), roots.data(), root_ast_names.data(),
+                    title.c_str(),
+                    (int)roots.size(), roots.data(), root_ast_names.data(), root_counts.data(),
                     &bdd,
                     outfile);
             }
+
+            if (L)
+            {
+                call_after_build(L, &bdd, (int)roots.size(), root_ast_ids.data(), roots.data());
+            }
         }
-#endif
     }
 }